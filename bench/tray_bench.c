@@ -0,0 +1,590 @@
+/* tray_bench.c - micro-benchmarks for the tray core hot paths
+ *
+ * Builds tray_windows.c directly (static helpers included) against the
+ * Win32 stubs in bench/win32_stub, so it runs on Linux. Each case reports
+ * the median of its samples; --runs repeats the whole suite and reports
+ * the median of the runs. Results are printed as JSON; with --baseline
+ * each result is compared to a stored run and the process exits non-zero
+ * when one regresses past the tolerance. Functional checks live in
+ * tray_test.c.
+ *
+ *   tray_bench [--json FILE] [--baseline FILE] [--tolerance RATIO] [--filter TEXT]
+ *              [--runs N] [--icon FILE]...   (real .ico/.png files for the ico_file cases)
+ */
+#include "../tray_windows.c"
+#include "tray_fixtures.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Timing                                                                    */
+/* -------------------------------------------------------------------------- */
+#define BENCH_MIN_NS   20000000.0   /* calibrate each sample to >= 20 ms */
+#define BENCH_SAMPLES  9
+#define BENCH_RUNS_MAX 15
+#define BENCH_NOISE_NS 5.0          /* absolute slack for sub-10 ns cases */
+
+typedef void (*bench_fn)(void *arg, long iters);
+
+typedef struct {
+    char   name[64];
+    double run_ns[BENCH_RUNS_MAX];  /* per run: median ns/op of the samples */
+    int    runs;
+    long   iterations;
+    double bytes_per_op;            /* 0 when throughput is meaningless */
+} bench_result;
+
+static bench_result *g_results = NULL;     /* grows as cases are added */
+static int           g_result_count = 0;
+static int           g_result_capacity = 0;
+static const char  *g_filter = NULL;
+
+/* Sorts v in place; n is small (samples or runs) */
+static double median(double *v, int n)
+{
+    for (int i = 1; i < n; i++) {
+        double x = v[i];
+        int j = i;
+        for (; j > 0 && v[j - 1] > x; j--) v[j] = v[j - 1];
+        v[j] = x;
+    }
+    return n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+static double result_ns(const bench_result *r)
+{
+    double v[BENCH_RUNS_MAX];
+    memcpy(v, r->run_ns, sizeof(v));
+    return median(v, r->runs);
+}
+
+/* Result of a case, added on its first run */
+static bench_result *result_for(const char *name)
+{
+    for (int i = 0; i < g_result_count; i++) {
+        if (!strcmp(g_results[i].name, name)) return &g_results[i];
+    }
+    if (g_result_count == g_result_capacity) {
+        int cap = g_result_capacity ? g_result_capacity * 2 : 64;
+        bench_result *grown = (bench_result *)realloc(g_results, (size_t)cap * sizeof(*grown));
+        if (!grown) {
+            fprintf(stderr, "%s: out of memory for results\n", name);
+            exit(2);
+        }
+        g_results = grown;
+        g_result_capacity = cap;
+    }
+    bench_result *r = &g_results[g_result_count++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    return r;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Median ns/op of BENCH_SAMPLES samples after calibrating the iteration
+   count: unlike the best sample it does not reward one lucky run */
+static void bench_run(const char *name, bench_fn fn, void *arg, double bytes_per_op)
+{
+    if (g_filter && !strstr(name, g_filter)) return;
+
+    long iters = 1;
+    for (;;) {
+        double t0 = now_ns();
+        fn(arg, iters);
+        if (now_ns() - t0 >= BENCH_MIN_NS || iters >= (1L << 30)) break;
+        iters *= 2;
+    }
+
+    double samples[BENCH_SAMPLES];
+    for (int s = 0; s < BENCH_SAMPLES; s++) {
+        double t0 = now_ns();
+        fn(arg, iters);
+        samples[s] = (now_ns() - t0) / (double)iters;
+    }
+    double mid = median(samples, BENCH_SAMPLES);
+
+    bench_result *r = result_for(name);
+    if (r->runs < BENCH_RUNS_MAX) r->run_ns[r->runs++] = mid;
+    r->iterations   = iters;
+    r->bytes_per_op = bytes_per_op;
+    fprintf(stderr, "%-36s %12.1f ns/op\n", name, mid);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Cases                                                                     */
+/* -------------------------------------------------------------------------- */
+static void case_utf8_to_wide(void *arg, long iters)
+{
+    const char *s = (const char *)arg;
+    for (long i = 0; i < iters; i++) {
+        LPWSTR w = utf8_to_wide(s);
+        free(w);
+    }
+}
+
+/* Steady state: the label is already interned */
+static void case_wstr_intern(void *arg, long iters)
+{
+    const char *s = (const char *)arg;
+    for (long i = 0; i < iters; i++) wstr_release(wstr_intern(s));
+}
+
+/* tray_update only marks the menu dirty; include the build a hover triggers */
+static void case_tray_update(void *arg, long iters)
+{
+    struct tray *t = (struct tray *)arg;
+    for (long i = 0; i < iters; i++) {
+        tray_update(t);
+        tray_prepare_menu(find_ctx_by_tray(t));
+    }
+}
+
+/* Burst of updates between two hovers: one build at the end */
+static void case_tray_update_burst(void *arg, long iters)
+{
+    struct tray *t = (struct tray *)arg;
+    for (long i = 0; i < iters; i++) {
+        for (int k = 0; k < 10; k++) tray_update(t);
+        tray_prepare_menu(find_ctx_by_tray(t));
+    }
+}
+
+typedef struct { HWND hwnd; UINT msg; WPARAM w; LPARAM l; } dispatch_arg;
+
+static void case_dispatch(void *arg, long iters)
+{
+    dispatch_arg *d = (dispatch_arg *)arg;
+    for (long i = 0; i < iters; i++) tray_wnd_proc(d->hwnd, d->msg, d->w, d->l);
+}
+
+/* Polled mode: queue the item event, drain in batches like a host would */
+static void case_dispatch_polled(void *arg, long iters)
+{
+    dispatch_arg *d = (dispatch_arg *)arg;
+    struct tray_event batch[64];
+    for (long i = 0; i < iters; i++) {
+        tray_wnd_proc(d->hwnd, d->msg, d->w, d->l);
+        if ((i & 63) == 63) g_dispatched += tray_poll_events(batch, 64);
+    }
+    while (tray_poll_events(batch, 64) > 0) {}
+}
+
+
+static void case_popup_update(void *arg, long iters)
+{
+    popup_arg *a = (popup_arg *)arg;
+    TrayContext *ctx = find_ctx_by_tray(a->tray);
+    for (long i = 0; i < iters; i++) {
+        int before = g_dispatched;
+        a->pick = ID_TRAY_FIRST + tray_menu_count(a->tray->menu) - 1;
+        tray_wnd_proc(ctx->hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, WM_RBUTTONUP);
+        if (g_dispatched != before + 1) {
+            fprintf(stderr, "popup pick did not reach its generation's item\n");
+            abort();
+        }
+    }
+}
+
+/* One span with a detail string, the shape of an icon load */
+static void case_trace_span(void *arg, long iters)
+{
+    (void)arg;
+    for (long i = 0; i < iters; i++) {
+        LONGLONG t = trace_begin();
+        trace_end(t, "icon_load", "icon", "C:\\icons\\settings.ico");
+    }
+}
+
+
+typedef struct { struct tray *tray; unsigned int flags; } init_arg;
+
+static void case_init_exit(void *arg, long iters)
+{
+    init_arg *a = (init_arg *)arg;
+    for (long i = 0; i < iters; i++) {
+        if (tray_init_ex(a->tray, a->flags) < 0) abort();
+        tray_exit();
+    }
+}
+
+typedef struct { HWND hwnd; UINT uid; } lookup_arg;
+
+static void case_lookup_hwnd(void *arg, long iters)
+{
+    lookup_arg *a = (lookup_arg *)arg;
+    for (long i = 0; i < iters; i++) {
+        if (!find_ctx_by_hwnd(a->hwnd)) abort();
+    }
+}
+
+static void case_lookup_uid(void *arg, long iters)
+{
+    lookup_arg *a = (lookup_arg *)arg;
+    for (long i = 0; i < iters; i++) {
+        if (!find_ctx_by_uid(a->uid)) abort();
+    }
+}
+
+typedef struct { tray_atlas_rect *rects; int count; } atlas_arg;
+
+static void case_atlas_pack(void *arg, long iters)
+{
+    atlas_arg *a = (atlas_arg *)arg;
+    for (long i = 0; i < iters; i++) {
+        if (tray_atlas_pack(a->rects, a->count, TRAY_ATLAS_PAGE_SIZE, TRAY_ATLAS_PAGE_SIZE) < 0)
+            abort();
+    }
+}
+
+static void bench_atlas(void)
+{
+    static const int counts[] = { 30, 300 };
+
+    for (size_t ci = 0; ci < sizeof(counts) / sizeof(counts[0]); ci++) {
+        int n = counts[ci];
+        tray_atlas_rect *rects = (tray_atlas_rect *)calloc((size_t)n, sizeof(*rects));
+        for (int i = 0; i < n; i++) {
+            /* Mostly menu-sized icons with a few larger ones mixed in */
+            rects[i].w = rects[i].h = (i % 7 == 0) ? 32 : TRAY_MENU_ICON_SIZE;
+        }
+        atlas_arg a = { rects, n };
+        char name[64];
+        snprintf(name, sizeof(name), "atlas_pack/n%d", n);
+        bench_run(name, case_atlas_pack, &a, 0);
+        free(rects);
+    }
+}
+
+static void bench_utf8(void)
+{
+    static const char ascii[] = "Settings";
+    static const char mixed[] =
+        "Paramètres avancés – Ελληνικά – 日本語のメニュー項目 – emoji 🚀 and a longer tail "
+        "so the conversion loop dominates the allocation cost of the call itself.";
+    bench_run("utf8_to_wide/ascii8", case_utf8_to_wide, (void *)ascii, sizeof(ascii) - 1);
+    bench_run("utf8_to_wide/mixed160", case_utf8_to_wide, (void *)mixed, sizeof(mixed) - 1);
+    bench_run("wstr_intern/ascii8", case_wstr_intern, (void *)ascii, sizeof(ascii) - 1);
+    bench_run("wstr_intern/mixed160", case_wstr_intern, (void *)mixed, sizeof(mixed) - 1);
+    wstr_clear();
+}
+
+static void bench_menus(void)
+{
+    static const int sizes[]  = { 10, 100, 1000 };
+    static const int depths[] = { 1, 3 };
+
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); si++) {
+        for (size_t di = 0; di < sizeof(depths) / sizeof(depths[0]); di++) {
+            int depth  = depths[di];
+            int fanout = (int)lround(pow((double)sizes[si], 1.0 / depth));
+            int count  = 0;
+            struct tray_menu_item *menu = menu_new(fanout, depth, &count);
+            struct tray t = { NULL, "Benchmark", count_tray_cb, menu };
+            if (tray_init(&t) < 0) abort();
+
+            TrayContext *ctx = find_ctx_by_tray(&t);
+            char name[64];
+            snprintf(name, sizeof(name), "tray_update/n%d_d%d", sizes[si], depth);
+            bench_run(name, case_tray_update, &t, 0);
+            snprintf(name, sizeof(name), "tray_update_x10/n%d_d%d", sizes[si], depth);
+            bench_run(name, case_tray_update_burst, &t, 0);
+
+            /* Deepest, last-built item: worst case for the command lookup */
+            dispatch_arg d = { ctx->hwnd, WM_COMMAND, (WPARAM)(ID_TRAY_FIRST + count - 1), 0 };
+            snprintf(name, sizeof(name), "dispatch_item/n%d_d%d", sizes[si], depth);
+            bench_run(name, case_dispatch, &d, 0);
+
+            if (si == 0 && di == 0) {
+                dispatch_arg c = { ctx->hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, WM_LBUTTONUP };
+                bench_run("dispatch_tray_click", case_dispatch, &c, 0);
+
+                tray_set_event_mode(1);
+                bench_run("dispatch_item_polled/n10_d1", case_dispatch_polled, &d, 0);
+                tray_set_event_mode(0);
+            }
+
+            tray_exit();
+            menu_free(menu);
+        }
+    }
+}
+
+/* Click, popup, concurrent update, pick: the whole generation round trip */
+static void bench_popup(void)
+{
+    int count = 0;
+    struct tray t = { NULL, "Benchmark", count_tray_cb, menu_new(100, 1, &count) };
+    if (tray_init(&t) < 0) abort();
+
+    popup_arg a = { &t, find_ctx_by_tray(&t)->hwnd, 0, 0, 0 };
+    g_popup = &a;
+    tray_stub_popup_hook = popup_hook;
+    bench_run("popup_update/n100_d1", case_popup_update, &a, 0);
+    tray_stub_popup_hook = NULL;
+    tray_exit();
+    menu_free(t.menu);
+}
+
+/* Time until tray_init returns (icon visible), full versus fast start */
+static void bench_startup(void)
+{
+    int count = 0;
+    struct tray_menu_item *menu = menu_new(1000, 1, &count);
+    struct tray t = { NULL, "Benchmark", count_tray_cb, menu };
+
+    init_arg full = { &t, 0 };
+    init_arg fast = { &t, TRAY_INIT_FAST };
+    bench_run("tray_init_exit/full_n1000", case_init_exit, &full, 0);
+    bench_run("tray_init_exit/fast_n1000", case_init_exit, &fast, 0);
+
+    menu_free(menu);
+}
+
+/* Cost of a span with tracing off (the default) and on */
+static void bench_trace(void)
+{
+    bench_run("trace_span/off", case_trace_span, NULL, 0);
+
+    trace_sink_arg a = { 0 };
+    if (tray_trace_start_sink(trace_sink, &a) < 0) abort();
+    bench_run("trace_span/on", case_trace_span, NULL, 0);
+    tray_trace_stop();
+}
+
+/* -------------------------------------------------------------------------- */
+/*  ICO/PNG decoding                                                          */
+/* -------------------------------------------------------------------------- */
+typedef struct { const unsigned char *data; size_t len; int px; unsigned int *out; } ico_arg;
+
+static void case_ico_select(void *arg, long iters)
+{
+    ico_arg *a = (ico_arg *)arg;
+    for (long i = 0; i < iters; i++) {
+        if (tray_ico_select(a->data, a->len, a->px, 96) < 0) abort();
+    }
+}
+
+static void case_ico_decode(void *arg, long iters)
+{
+    ico_arg *a = (ico_arg *)arg;
+    for (long i = 0; i < iters; i++) {
+        if (tray_ico_decode(a->data, a->len, a->out, a->px, a->px, a->px * 4) != 0) abort();
+    }
+}
+
+typedef struct { WStr *path; int px; DWORD *out; } ico_file_arg;
+
+/* Whole path of a menu icon: map, parse, decode, unmap */
+static void case_ico_file(void *arg, long iters)
+{
+    ico_file_arg *a = (ico_file_arg *)arg;
+    for (long i = 0; i < iters; i++) {
+        if (!icon_file_decode(a->path, a->out, a->px, a->px, a->px * 4)) abort();
+    }
+}
+
+static void bench_ico(const char **icons, int icon_count)
+{
+    size_t len = 0;
+    unsigned char *ico = ico_build(&len);
+    unsigned int out[48 * 48];
+
+    ico_arg sel = { ico, len, 24, out };
+    bench_run("ico_select/4_entries", case_ico_select, &sel, 0);
+    ico_arg bmp = { ico, len, 16, out };
+    bench_run("ico_decode/bmp32_16", case_ico_decode, &bmp, 0);
+    ico_arg bmp8 = { ico, len, 24, out };
+    bench_run("ico_decode/bmp8_24", case_ico_decode, &bmp8, 0);
+    ico_arg png = { png48, sizeof(png48), 48, out };
+    bench_run("ico_decode/png48", case_ico_decode, &png, sizeof(png48));
+    ico_arg png16 = { png48, sizeof(png48), 16, out };
+    bench_run("ico_decode/png48_to16", case_ico_decode, &png16, sizeof(png48));
+
+    /* Through a mapped file, as the icon worker does it */
+    char path[] = "/tmp/tray_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0 && write(fd, ico, len) == (ssize_t)len) {
+        ico_file_arg f = { wstr_intern(path), 16, (DWORD *)out };
+        bench_run("ico_file/mapped16", case_ico_file, &f, 0);
+        wstr_release(f.path);
+    }
+    if (fd >= 0) { close(fd); unlink(path); }
+
+    /* --icon FILE: real icons, decoded at menu and tray size */
+    static const int sizes[2] = { 16, 32 };
+    for (int i = 0; i < icon_count; i++) {
+        const char *base = strrchr(icons[i], '/');
+        base = base ? base + 1 : icons[i];
+        WStr *wicon = wstr_intern(icons[i]);
+        for (int s = 0; s < 2 && wicon; s++) {
+            ico_file_arg f = { wicon, sizes[s], (DWORD *)out };
+            char name[64];
+            snprintf(name, sizeof(name), "ico_file/%.40s@%d", base, sizes[s]);
+            if (!icon_file_decode(f.path, f.out, f.px, f.px, f.px * 4)) {
+                fprintf(stderr, "%s: not decodable, LoadImageW fallback\n", icons[i]);
+                break;
+            }
+            bench_run(name, case_ico_file, &f, 0);
+        }
+        wstr_release(wicon);
+    }
+    free(ico);
+}
+
+static void bench_lookup(void)
+{
+    static const int trays[] = { 1, 16, 256 };
+
+    for (size_t ti = 0; ti < sizeof(trays) / sizeof(trays[0]); ti++) {
+        struct tray *keys = (struct tray *)calloc((size_t)trays[ti], sizeof(*keys));
+        ensure_critical_section();
+        for (int i = 0; i < trays[ti]; i++) {
+            TrayContext *ctx = create_ctx(&keys[i]);
+            ctx->hwnd = (HWND)(uintptr_t)(0x10000 + i);
+        }
+        /* Oldest context sits at the tail of the list */
+        TrayContext *tail = g_ctx_head;
+        while (tail->next) tail = tail->next;
+        lookup_arg a = { tail->hwnd, tail->uID };
+
+        char name[64];
+        snprintf(name, sizeof(name), "ctx_lookup_hwnd/trays%d", trays[ti]);
+        bench_run(name, case_lookup_hwnd, &a, 0);
+        snprintf(name, sizeof(name), "ctx_lookup_uid/trays%d", trays[ti]);
+        bench_run(name, case_lookup_uid, &a, 0);
+
+        while (g_ctx_head) destroy_ctx(g_ctx_head);
+        free(keys);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Output and baseline comparison                                            */
+/* -------------------------------------------------------------------------- */
+static void write_json(FILE *f)
+{
+    fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (int i = 0; i < g_result_count; i++) {
+        bench_result *r = &g_results[i];
+        double ns = result_ns(r);
+        fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.1f, \"iterations\": %ld, \"runs\": %d",
+                r->name, ns, r->iterations, r->runs);
+        if (r->bytes_per_op > 0)
+            fprintf(f, ", \"mb_per_s\": %.1f", r->bytes_per_op * 1e3 / ns);
+        fprintf(f, "}%s\n", i + 1 < g_result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static char *read_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = (char *)malloc((size_t)n + 1);
+    if (buf && fread(buf, 1, (size_t)n, f) != (size_t)n) { free(buf); buf = NULL; }
+    if (buf) buf[n] = '\0';
+    fclose(f);
+    return buf;
+}
+
+/* Looks up "name" in a file written by write_json; returns < 0 if absent */
+static double baseline_ns(const char *json, const char *name)
+{
+    char key[96];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    const char *p = strstr(json, key);
+    if (!p) return -1.0;
+    p = strstr(p, "\"ns_per_op\":");
+    if (!p) return -1.0;
+    return strtod(p + strlen("\"ns_per_op\":"), NULL);
+}
+
+static int compare_baseline(const char *path, double tolerance)
+{
+    char *json = read_file(path);
+    if (!json) {
+        fprintf(stderr, "cannot read baseline %s\n", path);
+        return 1;
+    }
+    int regressions = 0;
+    for (int i = 0; i < g_result_count; i++) {
+        bench_result *r = &g_results[i];
+        double base = baseline_ns(json, r->name);
+        if (base <= 0) continue;
+        double ns = result_ns(r);
+        double ratio = ns / base;
+        if (ratio > tolerance && ns - base > BENCH_NOISE_NS) {
+            fprintf(stderr, "REGRESSION %-30s %.1f ns/op vs %.1f baseline (x%.2f)\n",
+                    r->name, ns, base, ratio);
+            regressions++;
+        }
+    }
+    free(json);
+    if (!regressions) fprintf(stderr, "no regressions (tolerance x%.2f)\n", tolerance);
+    return regressions ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *json_path = NULL;
+    const char *baseline  = NULL;
+    double tolerance = 2.0;
+    int runs = 1;
+    const char **icons = (const char **)malloc((size_t)argc * sizeof(*icons));
+    int icon_count = 0;
+    if (!icons) return 2;
+
+    for (int i = 1; i < argc; i++) {
+        if      (!strcmp(argv[i], "--json") && i + 1 < argc)      json_path = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc)  baseline  = argv[++i];
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) tolerance = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)    g_filter  = argv[++i];
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc)      runs      = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--icon") && i + 1 < argc)
+            icons[icon_count++] = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--json FILE] [--baseline FILE] "
+                            "[--tolerance RATIO] [--filter TEXT] [--runs N] [--icon FILE]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1 || runs > BENCH_RUNS_MAX) {
+        fprintf(stderr, "--runs must be 1..%d\n", BENCH_RUNS_MAX);
+        return 2;
+    }
+
+    for (int run = 0; run < runs; run++) {
+        if (runs > 1) fprintf(stderr, "run %d/%d\n", run + 1, runs);
+        bench_utf8();
+        bench_menus();
+        bench_popup();
+        bench_startup();
+        bench_trace();
+        bench_lookup();
+        bench_atlas();
+        bench_ico(icons, icon_count);
+    }
+    free(icons);
+
+    if (json_path) {
+        FILE *f = fopen(json_path, "w");
+        if (!f) { perror(json_path); return 2; }
+        write_json(f);
+        fclose(f);
+    } else {
+        write_json(stdout);
+    }
+
+    return baseline ? compare_baseline(baseline, tolerance) : 0;
+}
@@ -0,0 +1,118 @@
+/* tray_fixtures.h - menus, popup driver and trace sink shared by
+ * tray_bench.c and tray_test.c; icon files are in tray_ico_fixtures.h
+ *
+ * Include after tray_windows.c; everything here is static, like the
+ * helpers it exercises.
+ */
+#ifndef TRAY_FIXTURES_H
+#define TRAY_FIXTURES_H
+
+/* -------------------------------------------------------------------------- */
+/*  Synthetic menus                                                           */
+/* -------------------------------------------------------------------------- */
+static int g_dispatched = 0;            /* calls of the counting callbacks */
+
+static void count_item_cb(struct tray_menu_item *item) { (void)item; g_dispatched++; }
+static void count_tray_cb(struct tray *tray)           { (void)tray; g_dispatched++; }
+
+/* Builds a tree with the given fanout and depth; every 10th entry is "-" */
+static struct tray_menu_item *menu_new(int fanout, int depth, int *count)
+{
+    int slots = fanout + fanout / 10;
+    struct tray_menu_item *m =
+        (struct tray_menu_item *)calloc((size_t)slots + 1, sizeof(*m));
+    int k = 0;
+    for (int i = 0; i < fanout; i++) {
+        if (i && i % 10 == 0) m[k++].text = "-";
+        char buf[64];
+        snprintf(buf, sizeof(buf), "Élément %d – niveau %d", *count, depth);
+        m[k].text = strdup(buf);
+        m[k].cb   = count_item_cb;
+        m[k].checked = i & 1;
+        (*count)++;
+        if (depth > 1) m[k].submenu = menu_new(fanout, depth - 1, count);
+        k++;
+    }
+    return m;
+}
+
+static void menu_free(struct tray_menu_item *m)
+{
+    for (struct tray_menu_item *p = m; p && p->text; ++p) {
+        if (strcmp(p->text, "-") == 0) continue;
+        free(p->text);
+        menu_free(p->submenu);
+    }
+    free(m);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Popup driver (TrackPopupMenu hook of the stubs)                           */
+/* -------------------------------------------------------------------------- */
+
+/* Popup open on one generation while another thread swaps the menu,
+   frees the array it replaced and builds the next one; the pick must
+   still reach the shown item */
+typedef struct {
+    struct tray *tray;
+    HWND         hwnd;
+    UINT         pick;                 /* command chosen in the popup */
+    int          flip;                 /* alternates 100 and 10 items */
+    int          exit;                 /* writer calls tray_exit instead */
+} popup_arg;
+
+static popup_arg *g_popup;
+
+static void *popup_writer(void *arg)
+{
+    popup_arg *a = (popup_arg *)arg;
+    if (a->exit) {
+        tray_exit();                   /* no tray of its own: the fallback */
+        return NULL;
+    }
+    struct tray_menu_item *old = a->tray->menu;
+    int count = 0;
+    a->flip ^= 1;
+    a->tray->menu = menu_new(a->flip ? 10 : 100, 1, &count);
+    tray_update(a->tray);
+    menu_free(old);
+    /* Pointer over the icon: the next generation is built meanwhile */
+    tray_wnd_proc(a->hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, WM_MOUSEMOVE);
+    return NULL;
+}
+
+/* Runs inside TrackPopupMenu: a writer that blocks on tray_cs would hang here */
+static UINT popup_hook(HMENU m)
+{
+    pthread_t th;
+    (void)m;
+    if (pthread_create(&th, NULL, popup_writer, g_popup) != 0) abort();
+    pthread_join(th, NULL);
+    return g_popup->pick;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Trace sink                                                                */
+/* -------------------------------------------------------------------------- */
+
+/* Counts what the sink receives and keeps the tail of the document */
+typedef struct {
+    unsigned long long bytes;
+    int                chunks;
+    int                shape_ok;   /* document opens and closes as expected */
+    char               last[64];
+} trace_sink_arg;
+
+static void trace_sink(const char *json, unsigned int len, void *user)
+{
+    trace_sink_arg *a = (trace_sink_arg *)user;
+    if (a->chunks++ == 0) a->shape_ok = strncmp(json, "{\"traceEvents\":[", 16) == 0;
+    a->bytes += len;
+    size_t n = len < sizeof(a->last) - 1 ? len : sizeof(a->last) - 1;
+    memcpy(a->last, json + len - n, n);
+    a->last[n] = 0;
+}
+
+#include "tray_ico_fixtures.h"
+
+#endif /* TRAY_FIXTURES_H */
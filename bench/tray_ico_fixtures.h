@@ -0,0 +1,163 @@
+/* tray_ico_fixtures.h - ICO and PNG files built in memory, shared by
+ * tray_bench.c, tray_test.c and the decoder fuzz target
+ *
+ * Needs only the C library, so the fuzz target can use it without the
+ * tray core or the Win32 stubs.
+ */
+#ifndef TRAY_ICO_FIXTURES_H
+#define TRAY_ICO_FIXTURES_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/* -------------------------------------------------------------------------- */
+/*  ICO/PNG files                                                             */
+/* -------------------------------------------------------------------------- */
+
+/* 48 x 48 RGBA PNG written by zlib (dynamic Huffman, all five row filters):
+   transparent corners, an opaque (200,60,30) disc inside a (40,90,220,160) ring */
+static const unsigned char png48[] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+    0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x30, 0x08, 0x06, 0x00, 0x00, 0x00, 0x57, 0x02, 0xf9,
+    0x87, 0x00, 0x00, 0x01, 0x9e, 0x49, 0x44, 0x41, 0x54, 0x78, 0xda, 0xed, 0x9a, 0xad, 0x12, 0xc2,
+    0x30, 0x0c, 0x80, 0xb7, 0xb5, 0x1e, 0x83, 0x46, 0x21, 0x30, 0xdc, 0xf1, 0x00, 0x28, 0x9e, 0x00,
+    0x8d, 0x81, 0x27, 0xe0, 0x61, 0x78, 0x82, 0xcd, 0xa0, 0x79, 0x02, 0x34, 0x96, 0xc3, 0x20, 0x50,
+    0x68, 0x0c, 0x4f, 0x00, 0x17, 0xc1, 0x5d, 0xaf, 0xb7, 0xf4, 0x67, 0xc9, 0xd6, 0xae, 0x2c, 0x77,
+    0x55, 0x94, 0x24, 0x4d, 0xf2, 0xad, 0x5d, 0xba, 0x2c, 0xeb, 0xb9, 0xe4, 0x7d, 0x5f, 0x40, 0xd1,
+    0xf7, 0x05, 0x88, 0xbe, 0x2f, 0x40, 0x72, 0x2b, 0x9c, 0x6d, 0x1e, 0xa5, 0xe9, 0xf7, 0xfb, 0x71,
+    0xba, 0x8b, 0x2a, 0x02, 0xe0, 0x30, 0x65, 0x04, 0x83, 0x98, 0xc3, 0x38, 0x47, 0x66, 0x8a, 0x18,
+    0x9c, 0xa7, 0xe8, 0x14, 0xbe, 0x46, 0xc6, 0xf3, 0xfd, 0xda, 0x34, 0xa7, 0x7c, 0xae, 0xb6, 0xeb,
+    0x77, 0xb5, 0xc0, 0xc6, 0x69, 0xb4, 0xbd, 0x62, 0xff, 0x05, 0xdd, 0x30, 0x5e, 0xb7, 0xc3, 0x89,
+    0x1d, 0x62, 0x53, 0x84, 0xc0, 0x69, 0x57, 0x3d, 0xea, 0xdc, 0xdd, 0xe4, 0x5c, 0x61, 0xb6, 0x58,
+    0x61, 0xc7, 0x00, 0xbc, 0x2c, 0x27, 0x1f, 0x8e, 0x41, 0x01, 0x3c, 0x6f, 0x1a, 0x79, 0x9f, 0xa8,
+    0xbb, 0x08, 0x96, 0x0d, 0x5b, 0x26, 0x1a, 0x41, 0xcc, 0xed, 0x3c, 0x45, 0xa7, 0xf0, 0x8d, 0x7e,
+    0x1b, 0xce, 0xff, 0xa4, 0x0e, 0x72, 0x1b, 0xd4, 0x32, 0x16, 0xe7, 0x55, 0x1b, 0x7a, 0x39, 0x35,
+    0x82, 0xba, 0x2d, 0x60, 0x9b, 0x82, 0xed, 0x05, 0x71, 0xa8, 0xe8, 0xdb, 0xa0, 0xae, 0xcb, 0x42,
+    0x11, 0x0a, 0x5a, 0x2e, 0x9b, 0x02, 0xdb, 0x11, 0x75, 0xb8, 0x42, 0x1c, 0x14, 0x75, 0xa0, 0xeb,
+    0x60, 0x96, 0x59, 0x6a, 0x12, 0x1a, 0x5e, 0x5f, 0x98, 0x73, 0x1b, 0xc0, 0x21, 0xea, 0xdf, 0x04,
+    0xb3, 0x0e, 0x72, 0x7a, 0xef, 0xc4, 0xb1, 0x00, 0xec, 0x0a, 0xf2, 0x00, 0xf1, 0x00, 0xf1, 0x00,
+    0xb1, 0x26, 0x00, 0x89, 0x0a, 0x32, 0x40, 0x14, 0x0a, 0x64, 0x5b, 0xf4, 0xd3, 0x84, 0x38, 0x26,
+    0x90, 0x5d, 0x8e, 0xd4, 0x69, 0x1e, 0xa7, 0xa3, 0xeb, 0x5f, 0x1a, 0x7c, 0x12, 0xa6, 0x26, 0x93,
+    0xbe, 0x23, 0x76, 0x05, 0x73, 0x5d, 0xf4, 0xb1, 0xf7, 0x62, 0x69, 0x5a, 0xb1, 0x5e, 0x4a, 0xa0,
+    0xb8, 0xed, 0x52, 0x72, 0x2d, 0x1d, 0x52, 0x53, 0xab, 0x2b, 0x68, 0x5d, 0x9a, 0x5b, 0xe9, 0x37,
+    0xb6, 0x30, 0x05, 0x98, 0xc1, 0x2e, 0x9d, 0xb7, 0x36, 0xb6, 0xb0, 0xdd, 0x59, 0x05, 0x9b, 0x02,
+    0x37, 0x38, 0x8e, 0x75, 0xab, 0x5d, 0xeb, 0x5e, 0xfa, 0x3c, 0xc6, 0xb0, 0x72, 0x52, 0x23, 0x68,
+    0x2b, 0x2d, 0x97, 0xcc, 0xb5, 0xfe, 0x18, 0xa7, 0x5e, 0x2b, 0x71, 0x5e, 0x37, 0xfd, 0xe7, 0x15,
+    0xd3, 0xcf, 0x20, 0x47, 0xaa, 0xa9, 0x7a, 0xc8, 0xf7, 0xc4, 0x00, 0xb8, 0x3a, 0x6c, 0x57, 0x50,
+    0xe0, 0xac, 0x3a, 0x9f, 0x6a, 0x9f, 0xfd, 0x38, 0x1d, 0xe3, 0x39, 0x2a, 0x6a, 0x19, 0x3e, 0xf6,
+    0x08, 0x2d, 0x5f, 0xee, 0x78, 0x13, 0x3d, 0xd8, 0x7f, 0x96, 0x05, 0x00, 0x00, 0x00, 0x00, 0x49,
+    0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82,
+};
+
+static unsigned char *put16(unsigned char *p, unsigned int v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); return p + 2; }
+static unsigned char *put32(unsigned char *p, unsigned int v) { return put16(put16(p, v & 0xFFFF), v >> 16); }
+
+/* BITMAPINFOHEADER of an icon entry: height covers XOR image and AND mask */
+static unsigned char *put_bmp_header(unsigned char *p, int w, int bpp)
+{
+    p = put32(p, 40); p = put32(p, (unsigned int)w); p = put32(p, (unsigned int)(2 * w));
+    p = put16(p, 1);  p = put16(p, (unsigned int)bpp);
+    for (int i = 0; i < 6; i++) p = put32(p, 0);
+    return p;
+}
+
+/* 32 bpp: B = 8x, G = 8y, R = 100, left half opaque, right half A = 128 */
+static unsigned char *put_bmp32(unsigned char *p, int w)
+{
+    p = put_bmp_header(p, w, 32);
+    for (int row = 0; row < w; row++) {
+        int y = w - 1 - row;                      /* bottom-up */
+        for (int x = 0; x < w; x++) {
+            *p++ = (unsigned char)(x * 8); *p++ = (unsigned char)(y * 8);
+            *p++ = 100;                    *p++ = x < w / 2 ? 255 : 128;
+        }
+    }
+    memset(p, 0, (size_t)((w + 31) / 32) * 4 * w);  /* AND mask unused */
+    return p + ((w + 31) / 32) * 4 * w;
+}
+
+/* 8 bpp: index (x + y) & 255 into (B = i, G = 255 - i, R = 50); x < 4 masked out */
+static unsigned char *put_bmp8(unsigned char *p, int w)
+{
+    p = put_bmp_header(p, w, 8);
+    for (int i = 0; i < 256; i++) { *p++ = (unsigned char)i; *p++ = (unsigned char)(255 - i); *p++ = 50; *p++ = 0; }
+    int stride = (w + 3) & ~3, mask_stride = ((w + 31) / 32) * 4;
+    for (int row = 0; row < w; row++) {
+        int y = w - 1 - row;
+        for (int x = 0; x < stride; x++) *p++ = (unsigned char)(x < w ? (x + y) & 255 : 0);
+    }
+    for (int row = 0; row < w; row++) {
+        memset(p, 0, (size_t)mask_stride);
+        p[0] = 0xF0;
+        p += mask_stride;
+    }
+    return p;
+}
+
+static unsigned char *put32be(unsigned char *p, unsigned int v)
+{
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);  p[3] = (unsigned char)v;
+    return p + 4;
+}
+
+/* PNG chunk; CRCs are left zero, the decoder does not check them */
+static unsigned char *put_png_chunk(unsigned char *p, const char *type, const unsigned char *data, size_t len)
+{
+    p = put32be(p, (unsigned int)len);
+    memcpy(p, type, 4);
+    if (len) memcpy(p + 4, data, len);
+    return put32be(p + 4 + len, 0);
+}
+
+/* One-row 8-bit PNG of colour type 0 (gray) or 2 (RGB), stored rather than
+   compressed, with an optional tRNS chunk of trns_len bytes */
+static size_t png_build(unsigned char *png, int ctype, const unsigned char *px, int w,
+                        const unsigned char *trns, size_t trns_len)
+{
+    static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+    size_t row = (size_t)w * (ctype == 2 ? 3 : 1) + 1;      /* filter byte + samples */
+    unsigned char ihdr[13] = { 0 }, idat[2 + 5 + 256 + 4] = { 0 };
+    put32be(ihdr, (unsigned int)w);
+    put32be(ihdr + 4, 1);
+    ihdr[8] = 8;
+    ihdr[9] = (unsigned char)ctype;
+
+    idat[0] = 0x78; idat[1] = 0x01;                          /* zlib, no dictionary */
+    idat[2] = 1;                                             /* final stored block */
+    put16(idat + 3, (unsigned int)row);
+    put16(idat + 5, (unsigned int)~row & 0xFFFF);
+    memcpy(idat + 8, px, row - 1);                           /* filter 0 */
+                                                             /* Adler-32 left zero */
+    unsigned char *p = png;
+    memcpy(p, sig, 8);
+    p = put_png_chunk(p + 8, "IHDR", ihdr, 13);
+    if (trns) p = put_png_chunk(p, "tRNS", trns, trns_len);
+    p = put_png_chunk(p, "IDAT", idat, 7 + row + 4);
+    p = put_png_chunk(p, "IEND", NULL, 0);
+    return (size_t)(p - png);
+}
+
+/* ICO with 16 and 32 px 32 bpp entries, a 24 px 8 bpp one and png48 */
+static unsigned char *ico_build(size_t *len)
+{
+    static const int sides[4] = { 16, 32, 24, 48 };
+    static const int bpps[4]  = { 32, 32, 8, 32 };
+    unsigned char *ico = (unsigned char *)calloc(1, 64 * 1024);
+    unsigned char *p = ico + 6 + 4 * 16;
+    put16(ico, 0); put16(ico + 2, 1); put16(ico + 4, 4);
+    for (int i = 0; i < 4; i++) {
+        unsigned char *start = p;
+        if (i == 3)         { memcpy(p, png48, sizeof(png48)); p += sizeof(png48); }
+        else if (bpps[i] == 8) p = put_bmp8(p, sides[i]);
+        else                   p = put_bmp32(p, sides[i]);
+        unsigned char *e = ico + 6 + i * 16;
+        e[0] = (unsigned char)sides[i]; e[1] = (unsigned char)sides[i];
+        put16(e + 4, 1); put16(e + 6, (unsigned int)bpps[i]);
+        put32(e + 8, (unsigned int)(p - start)); put32(e + 12, (unsigned int)(start - ico));
+    }
+    *len = (size_t)(p - ico);
+    return ico;
+}
+
+#endif /* TRAY_ICO_FIXTURES_H */
@@ -0,0 +1,139 @@
+/* tray_ico_fuzz.c - fuzz target for the ICO/PNG decoder
+ *
+ * With Clang this is a libFuzzer target, built with
+ * -fsanitize=fuzzer,address,undefined; `--target ico_fuzz` writes the seed
+ * corpus and fuzzes it for TRAY_FUZZ_SECONDS. Built with TRAY_FUZZ_MAIN
+ * (any compiler), main() instead replays the seeds and a fixed series of
+ * mutations of them, which ctest runs under ASan/UBSan.
+ *
+ *   tray_ico_fuzz_replay [--seeds DIR] [ITERATIONS]
+ */
+#include "../tray_ico.h"
+#include "tray_ico_fixtures.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Menu size, tray size at 144 DPI, and an upscale past every entry */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static unsigned int out[64 * 64];
+    static const int sides[3] = { 16, 24, 64 };
+    tray_ico_select(data, size, 16, 96);
+    for (int i = 0; i < 3; i++) tray_ico_decode(data, size, out, sides[i], sides[i], sides[i] * 4);
+    return 0;
+}
+
+#ifdef TRAY_FUZZ_MAIN
+#include <sys/stat.h>
+
+#define SEED_COUNT 4
+
+/* The ICO of the functional checks, its PNG entry alone and colour-key PNGs */
+static size_t seeds_make(unsigned char *seeds[SEED_COUNT], size_t lens[SEED_COUNT])
+{
+    static const unsigned char gray[3] = { 10, 20, 30 }, rgb[6] = { 1, 2, 3, 4, 5, 6 };
+    static const unsigned char gray_key[2] = { 0, 20 }, rgb_key[6] = { 0, 4, 0, 5, 0, 6 };
+
+    seeds[0] = ico_build(&lens[0]);
+    seeds[1] = (unsigned char *)malloc(sizeof(png48));
+    seeds[2] = (unsigned char *)malloc(512);
+    seeds[3] = (unsigned char *)malloc(512);
+    if (!seeds[0] || !seeds[1] || !seeds[2] || !seeds[3]) return 0;
+    memcpy(seeds[1], png48, sizeof(png48));
+    lens[1] = sizeof(png48);
+    lens[2] = png_build(seeds[2], 0, gray, 3, gray_key, sizeof(gray_key));
+    lens[3] = png_build(seeds[3], 2, rgb, 2, rgb_key, sizeof(rgb_key));
+    return SEED_COUNT;
+}
+
+static int seeds_write(const char *dir, unsigned char *seeds[], const size_t lens[], size_t count)
+{
+    mkdir(dir, 0777);
+    for (size_t i = 0; i < count; i++) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/seed%zu", dir, i);
+        FILE *f = fopen(path, "wb");
+        if (!f || fwrite(seeds[i], 1, lens[i], f) != lens[i]) {
+            if (f) fclose(f);
+            fprintf(stderr, "%s: cannot write\n", path);
+            return 1;
+        }
+        fclose(f);
+    }
+    return 0;
+}
+
+static unsigned int fuzz_rand(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/* Byte flips, stuck bytes, 32-bit boundary values and truncation: what
+   breaks length and offset fields in ICO directories and PNG chunks */
+static size_t mutate(unsigned char *buf, size_t len, unsigned int *rng)
+{
+    int edits = 1 + (int)(fuzz_rand(rng) % 8);
+    for (int e = 0; e < edits && len; e++) {
+        size_t at = fuzz_rand(rng) % len;
+        switch (fuzz_rand(rng) % 4) {
+        case 0: buf[at] ^= (unsigned char)(1u << (fuzz_rand(rng) % 8)); break;
+        case 1: buf[at] = (fuzz_rand(rng) & 1) ? 0xFF : 0x00; break;
+        case 2:
+            if (len - at >= 4) {
+                static const unsigned int edge[4] = { 0, 1, 0x7FFFFFFF, 0xFFFFFFFF };
+                unsigned int v = edge[fuzz_rand(rng) % 4];
+                memcpy(buf + at, &v, 4);
+            }
+            break;
+        default: len = at; break;
+        }
+    }
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *seeds[SEED_COUNT] = { 0 };
+    size_t lens[SEED_COUNT] = { 0 };
+    long iterations = 50000;
+    const char *seed_dir = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--seeds") && i + 1 < argc) seed_dir = argv[++i];
+        else if ((iterations = strtol(argv[i], NULL, 10)) <= 0) {
+            fprintf(stderr, "usage: %s [--seeds DIR] [ITERATIONS]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    size_t count = seeds_make(seeds, lens);
+    if (!count) return 1;
+    int ret = 0;
+    if (seed_dir) {
+        ret = seeds_write(seed_dir, seeds, lens, count);
+    } else {
+        for (size_t i = 0; i < count; i++) LLVMFuzzerTestOneInput(seeds[i], lens[i]);
+        /* A copy of exactly the input size, so ASan sees reads past it */
+        unsigned int rng = 0x2545F491u;
+        for (long n = 0; n < iterations; n++) {
+            size_t s = (size_t)n % count;
+            unsigned char *buf = (unsigned char *)malloc(lens[s]);
+            if (!buf) return 1;
+            memcpy(buf, seeds[s], lens[s]);
+            size_t len = mutate(buf, lens[s], &rng);
+            unsigned char *input = (unsigned char *)malloc(len ? len : 1);
+            if (!input) return 1;
+            memcpy(input, buf, len);
+            free(buf);
+            LLVMFuzzerTestOneInput(input, len);
+            free(input);
+        }
+        fprintf(stderr, "%zu seeds, %ld mutations decoded\n", count, iterations);
+    }
+    for (size_t i = 0; i < SEED_COUNT; i++) free(seeds[i]);
+    return ret;
+}
+#endif /* TRAY_FUZZ_MAIN */
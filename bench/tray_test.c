@@ -0,0 +1,547 @@
+/* tray_test.c - functional checks of the tray core
+ *
+ * Builds tray_windows.c against the Win32 stubs, like tray_bench.c, but
+ * only checks behaviour: the bench measures time and nothing else. Each
+ * check is its own ctest case; without arguments every check runs.
+ *
+ *   tray_test [NAME]...
+ */
+#include "../tray_windows.c"
+#include "tray_fixtures.h"
+
+/* -------------------------------------------------------------------------- */
+/*  Menus, handles and events                                                 */
+/* -------------------------------------------------------------------------- */
+/* Handles survive updates that keep the layout and fail once it changes;
+   the setters build what tray_update left pending, for their tray only */
+static void handle_check(struct tray *t)
+{
+    TrayContext *ctx = find_ctx_by_tray(t);
+    struct tray_menu_item *menu = t->menu;
+
+    /* A second tray with a pending menu, owned by no thread (tray_update
+       prefers the caller's own tray) */
+    int other_count = 0;
+    struct tray other = { NULL, "Other", NULL, menu_new(3, 1, &other_count) };
+    TrayContext *octx = create_ctx(&other);
+    octx->threadId   = 0;
+    octx->menu_dirty = TRUE;
+
+    int h = tray_item_get_handle(&menu[0]);
+    if (h <= 0 || tray_item_set_checked(h, 1) != 0) {
+        fprintf(stderr, "no usable handle for a menu item\n");
+        abort();
+    }
+    tray_update(t);
+    if (tray_item_set_checked(h, 0) != 0 || menu[0].checked || ctx->menu_dirty ||
+        tray_item_get_handle(&menu[1]) <= 0 || !octx->menu_dirty) {
+        fprintf(stderr, "handle lost across an update with the same layout\n");
+        abort();
+    }
+    char *text = menu[1].text;
+    menu[1].text = "-";
+    tray_update(t);
+    if (tray_item_set_checked(h, 1) != -1) {
+        fprintf(stderr, "stale handle accepted after a layout change\n");
+        abort();
+    }
+
+    /* An empty label takes no command ID: filling it in shifts the items
+       after it, so their old handles must not land on it */
+    menu[1].text = "";
+    tray_update(t);
+    int h2 = tray_item_get_handle(&menu[2]);
+    menu[1].text    = "X";
+    menu[1].checked = 0;
+    tray_update(t);
+    if (h2 <= 0 || tray_item_set_checked(h2, 1) != -1 || menu[1].checked) {
+        fprintf(stderr, "handle retargeted after an empty label was filled in\n");
+        abort();
+    }
+    menu[1].text = text;
+    tray_update(t);
+    tray_prepare_menu(ctx);
+    destroy_ctx(octx);
+    menu_free(other.menu);
+}
+
+/* Polled mode queues items and tray clicks that have no cb at all */
+static void polled_check(struct tray *t)
+{
+    TrayContext *ctx = find_ctx_by_tray(t);
+    struct tray_menu_item *mi = &t->menu[0];
+    void (*item_cb)(struct tray_menu_item *) = mi->cb;
+    void (*tray_cb)(struct tray *) = t->cb;
+    struct tray_event ev[4];
+
+    mi->cb = NULL;
+    t->cb  = NULL;
+    tray_update(t);
+    tray_prepare_menu(ctx);
+    tray_set_event_mode(1);
+    tray_wnd_proc(ctx->hwnd, WM_COMMAND, ID_TRAY_FIRST, 0);
+    tray_wnd_proc(ctx->hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, WM_LBUTTONUP);
+    int n = tray_poll_events(ev, 4);
+    tray_set_event_mode(0);
+    if (n != 2 || ev[0].kind != TRAY_EVENT_MENU_ITEM || ev[0].item != tray_item_get_handle(mi) ||
+        ev[1].kind != TRAY_EVENT_CLICK) {
+        fprintf(stderr, "polled mode lost events of items or trays without cb\n");
+        abort();
+    }
+    mi->cb = item_cb;
+    t->cb  = tray_cb;
+    tray_update(t);
+    tray_prepare_menu(ctx);
+}
+
+static void test_handles(void)
+{
+    int count = 0;
+    struct tray t = { NULL, "Test", count_tray_cb, menu_new(10, 1, &count) };
+    if (tray_init(&t) < 0) abort();
+    handle_check(&t);
+    tray_exit();
+    menu_free(t.menu);
+}
+
+static void test_polled(void)
+{
+    int count = 0;
+    struct tray t = { NULL, "Test", count_tray_cb, menu_new(10, 1, &count) };
+    if (tray_init(&t) < 0) abort();
+    polled_check(&t);
+
+    /* A host that drains in batches loses nothing */
+    TrayContext *ctx = find_ctx_by_tray(&t);
+    struct tray_event batch[64];
+    int queued = 0;
+    tray_set_event_mode(1);
+    for (int i = 0; i < 10000; i++) {
+        tray_wnd_proc(ctx->hwnd, WM_COMMAND, ID_TRAY_FIRST + count - 1, 0);
+        if ((i & 63) == 63) queued += tray_poll_events(batch, 64);
+    }
+    for (int n; (n = tray_poll_events(batch, 64)) > 0;) queued += n;
+    tray_set_event_mode(0);
+    if (queued != 10000 || tray_get_dropped_events()) {
+        fprintf(stderr, "event queue dropped events while draining\n");
+        abort();
+    }
+    tray_exit();
+    menu_free(t.menu);
+}
+
+/* Repeated updates of an unchanged menu convert nothing */
+static void test_strings(void)
+{
+    struct tray_string_stats st0, st;
+    int count = 0;
+    struct tray t = { NULL, "Test", count_tray_cb, menu_new(100, 1, &count) };
+    if (tray_init(&t) < 0) abort();
+    tray_get_string_stats(&st0);
+    for (int i = 0; i < 20; i++) {
+        tray_update(&t);
+        tray_prepare_menu(find_ctx_by_tray(&t));
+    }
+    tray_get_string_stats(&st);
+    unsigned int hits = st.hits - st0.hits, misses = st.misses - st0.misses;
+    if (!hits || hits < 10 * misses) {
+        fprintf(stderr, "string cache hit rate too low (%u hits, %u misses)\n", hits, misses);
+        abort();
+    }
+    tray_exit();
+    menu_free(t.menu);
+
+    /* Unique strings past the bound: LRU eviction keeps the table bounded */
+    char key[32];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "test label %d", i);
+        wstr_release(wstr_intern(key));
+    }
+    tray_get_string_stats(&st);
+    if (st.bytes > TRAY_WSTR_CACHE_BYTES || !st.evictions) {
+        fprintf(stderr, "string cache exceeded its bound (%u bytes)\n", st.bytes);
+        abort();
+    }
+    wstr_clear();
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Popup, startup and tracing                                                */
+/* -------------------------------------------------------------------------- */
+
+/* Picks reach the shown generation while another thread swaps the menu;
+   tray_exit from another thread while the popup is open lets the popup
+   finish the teardown once it closes and drop its pick */
+static void test_popup(void)
+{
+    int count = 0;
+    struct tray t = { NULL, "Test", count_tray_cb, menu_new(100, 1, &count) };
+    if (tray_init(&t) < 0) abort();
+
+    popup_arg a = { &t, find_ctx_by_tray(&t)->hwnd, 0, 0, 0 };
+    g_popup = &a;
+    tray_stub_popup_hook = popup_hook;
+    for (int i = 0; i < 50; i++) {
+        int before = g_dispatched;
+        a.pick = ID_TRAY_FIRST + tray_menu_count(t.menu) - 1;
+        tray_wnd_proc(a.hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, WM_RBUTTONUP);
+        if (g_dispatched != before + 1) {
+            fprintf(stderr, "popup pick did not reach its generation's item\n");
+            abort();
+        }
+    }
+
+    int before = g_dispatched;
+    a.exit = 1;
+    a.pick = ID_TRAY_FIRST;
+    tray_wnd_proc(a.hwnd, WM_TRAY_CALLBACK_MESSAGE, 0, WM_RBUTTONUP);
+    if (g_ctx_head || g_ctx_pinned || cs_initialized || g_dispatched != before) {
+        fprintf(stderr, "tray_exit during a popup left state behind\n");
+        abort();
+    }
+    tray_stub_popup_hook = NULL;
+    menu_free(t.menu);
+}
+
+/* Full start returns with the menu built, fast start defers it */
+static void test_startup(void)
+{
+    int count = 0;
+    struct tray t = { NULL, "Test", count_tray_cb, menu_new(1000, 1, &count) };
+    struct tray_startup_timings st;
+
+    if (tray_init(&t) < 0) abort();
+    TrayContext *ctx = find_ctx_by_tray(&t);
+    if (!ctx->menu || ctx->menu_dirty || tray_get_startup_timings(&st) || st.menu_ms <= 0) {
+        fprintf(stderr, "full tray_init returned without building the menu\n");
+        abort();
+    }
+    tray_exit();
+
+    if (tray_init_ex(&t, TRAY_INIT_FAST) < 0) abort();
+    ctx = find_ctx_by_tray(&t);
+    if (!ctx->menu_dirty || !ctx->startup_pending) {
+        fprintf(stderr, "fast tray_init built the menu before returning\n");
+        abort();
+    }
+    tray_exit();
+    menu_free(t.menu);
+}
+
+static void trace_spans(int n)
+{
+    for (int i = 0; i < n; i++) {
+        LONGLONG t = trace_begin();
+        trace_end(t, "icon_load", "icon", "C:\\icons\\settings.ico");
+    }
+}
+
+/* A pool thread that records a span and exits */
+static void *trace_thread(void *arg)
+{
+    (void)arg;
+    trace_spans(1);
+    return NULL;
+}
+
+static void test_trace(void)
+{
+    trace_sink_arg a = { 0 };
+    if (tray_trace_start_sink(trace_sink, &a) < 0) abort();
+    trace_spans(5000);                   /* several buffers' worth */
+    pthread_t th;
+    if (pthread_create(&th, NULL, trace_thread, NULL) != 0) abort();
+    pthread_join(th, NULL);
+    /* Full buffers wait for stop: spans may close under tray_cs */
+    if (a.chunks != 1) {
+        fprintf(stderr, "a full trace buffer was written while recording\n");
+        abort();
+    }
+    tray_trace_stop();
+    if (a.chunks != 1 + 5001 + 1 || !a.shape_ok || !strstr(a.last, "]")) {
+        fprintf(stderr, "trace output is not a complete trace-event document\n");
+        abort();
+    }
+    /* Buffers of every thread, exited ones included, go with the session */
+    if (g_trace_bufs || g_trace_tls != TLS_OUT_OF_INDEXES) {
+        fprintf(stderr, "tray_trace_stop kept per-thread trace buffers\n");
+        abort();
+    }
+    /* A later session starts from scratch */
+    trace_sink_arg b = { 0 };
+    if (tray_trace_start_sink(trace_sink, &b) < 0) abort();
+    trace_spans(1);
+    tray_trace_stop();
+    if (!b.shape_ok || !strstr(b.last, "]")) {
+        fprintf(stderr, "second trace session is not a complete document\n");
+        abort();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Icons                                                                     */
+/* -------------------------------------------------------------------------- */
+/* Packed cells must stay inside their page and never overlap */
+static void atlas_check(const tray_atlas_rect *r, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (r[i].page < 0 || r[i].x < 0 || r[i].y < 0 ||
+            r[i].x + r[i].w > TRAY_ATLAS_PAGE_SIZE || r[i].y + r[i].h > TRAY_ATLAS_PAGE_SIZE) {
+            fprintf(stderr, "atlas cell %d out of bounds\n", i);
+            abort();
+        }
+        for (int j = 0; j < i; j++) {
+            if (r[i].page == r[j].page &&
+                r[i].x < r[j].x + r[j].w && r[j].x < r[i].x + r[i].w &&
+                r[i].y < r[j].y + r[j].h && r[j].y < r[i].y + r[i].h) {
+                fprintf(stderr, "atlas cells %d and %d overlap\n", j, i);
+                abort();
+            }
+        }
+    }
+}
+
+static void test_atlas(void)
+{
+    static const int counts[] = { 30, 300 };
+
+    for (size_t ci = 0; ci < sizeof(counts) / sizeof(counts[0]); ci++) {
+        int n = counts[ci];
+        tray_atlas_rect *rects = (tray_atlas_rect *)calloc((size_t)n, sizeof(*rects));
+        for (int i = 0; i < n; i++) {
+            rects[i].w = rects[i].h = (i % 7 == 0) ? 32 : TRAY_MENU_ICON_SIZE;
+        }
+        if (tray_atlas_pack(rects, n, TRAY_ATLAS_PAGE_SIZE, TRAY_ATLAS_PAGE_SIZE) < 0) abort();
+        atlas_check(rects, n);
+        free(rects);
+    }
+}
+
+static void ico_expect(const unsigned int *img, int px, int x, int y, unsigned int want, const char *what)
+{
+    if (img[y * px + x] != want) {
+        fprintf(stderr, "%s: pixel (%d,%d) is %08x, expected %08x\n", what, x, y, img[y * px + x], want);
+        abort();
+    }
+}
+
+/* Decoding must reject or survive damaged files: random byte flips of the
+   test ICO plus every truncation */
+static void ico_mutation_pass(const unsigned char *ico, size_t len)
+{
+    unsigned char *copy = (unsigned char *)malloc(len);
+    unsigned int out[48 * 48];
+    unsigned int rng = 0x2545F491u;
+    for (int round = 0; round < 3000; round++) {
+        memcpy(copy, ico, len);
+        int flips = 1 + round % 8;
+        for (int f = 0; f < flips; f++) {
+            rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+            copy[rng % len] = (unsigned char)(rng >> 24);
+        }
+        tray_ico_decode(copy, len, out, 16, 16, 16 * 4);
+        tray_ico_decode(copy, len, out, 48, 48, 48 * 4);
+    }
+    for (size_t n = 0; n < len; n++) tray_ico_decode(ico, n, out, 48, 48, 48 * 4);
+    free(copy);
+}
+
+static void test_ico(void)
+{
+    size_t len = 0;
+    unsigned char *ico = ico_build(&len);
+    unsigned int out[48 * 48];
+
+    /* Entry choice: exact, DPI scaled, next larger, largest */
+    if (tray_ico_select(ico, len, 16, 96)  != 0 || tray_ico_select(ico, len, 16, 144) != 2 ||
+        tray_ico_select(ico, len, 20, 96)  != 2 || tray_ico_select(ico, len, 40, 96)  != 3 ||
+        tray_ico_select(ico, len, 64, 96)  != 3) {
+        fprintf(stderr, "ico entry selection is wrong\n");
+        abort();
+    }
+    if (tray_ico_decode(ico, len, out, 16, 16, 16 * 4)) abort();
+    ico_expect(out, 16, 12, 3, 0x80320C30, "bmp32");
+    if (tray_ico_decode(ico, len, out, 24, 24, 24 * 4)) abort();
+    ico_expect(out, 24, 2, 5, 0x00000000, "bmp8 masked");
+    ico_expect(out, 24, 10, 5, 0xFF32F00F, "bmp8");
+    if (tray_ico_decode(ico, len, out, 48, 48, 48 * 4)) abort();
+    ico_expect(out, 48, 0, 0, 0x00000000, "png corner");
+    ico_expect(out, 48, 24, 24, 0xFFC83C1E, "png disc");
+    ico_expect(out, 48, 41, 24, 0xA019388A, "png ring");
+
+    /* tRNS colour key of gray and RGB PNGs; a key above 255 matches nothing */
+    static const unsigned char gray[3] = { 10, 20, 30 }, rgb[6] = { 1, 2, 3, 4, 5, 6 };
+    static const unsigned char gray_key[2] = { 0, 20 }, rgb_key[6] = { 0, 4, 0, 5, 0, 6 };
+    static const unsigned char wide_key[2] = { 1, 20 };
+    unsigned char png[512];
+    size_t n = png_build(png, 0, gray, 3, gray_key, 2);
+    if (tray_ico_decode(png, n, out, 3, 1, 3 * 4)) abort();
+    ico_expect(out, 3, 0, 0, 0xFF0A0A0A, "gray");
+    ico_expect(out, 3, 1, 0, 0x00000000, "gray key");
+    n = png_build(png, 2, rgb, 2, rgb_key, 6);
+    if (tray_ico_decode(png, n, out, 2, 1, 2 * 4)) abort();
+    ico_expect(out, 2, 0, 0, 0xFF010203, "rgb");
+    ico_expect(out, 2, 1, 0, 0x00000000, "rgb key");
+    n = png_build(png, 0, gray, 3, wide_key, 2);
+    if (tray_ico_decode(png, n, out, 3, 1, 3 * 4)) abort();
+    ico_expect(out, 3, 1, 0, 0xFF141414, "gray 16-bit key");
+
+    ico_mutation_pass(ico, len);
+    free(ico);
+}
+
+/* Icon files the stub opens for real, removed again by icon_files_free */
+static void icon_files_new(char paths[][32], int n)
+{
+    size_t len = 0;
+    unsigned char *ico = ico_build(&len);
+    for (int i = 0; i < n; i++) {
+        strcpy(paths[i], "/tmp/tray_test_XXXXXX");
+        int fd = mkstemp(paths[i]);
+        if (fd < 0 || write(fd, ico, len) != (ssize_t)len) abort();
+        close(fd);
+    }
+    free(ico);
+}
+
+static void icon_files_free(char paths[][32], int n)
+{
+    for (int i = 0; i < n; i++) unlink(paths[i]);
+}
+
+static void icons_pump(void)
+{
+    MSG m;
+    while (PeekMessageW(&m, NULL, 0, 0, PM_REMOVE)) DispatchMessageW(&m);
+}
+
+/* Pixel of a menu item's icon in its generation's atlas, 0 if none drawn */
+static DWORD icons_pixel(const MenuGen *gen, int item, int x, int y)
+{
+    const IconAtlas *atlas = gen->atlas;
+    if (!atlas || !atlas->pages || atlas->cells[item].w <= 0) return 0;
+    const tray_atlas_rect *r = &atlas->cells[item];
+    return atlas->pages->bits[r->page][(size_t)(r->y + y) * TRAY_ATLAS_PAGE_SIZE + r->x + x];
+}
+
+/* Decoded icons still queued when the window goes are freed with it; an
+   unchanged tray icon is not decoded again, and a rebuild keeps the
+   pixels of paths the previous generation already shows */
+static void test_icons(void)
+{
+    char paths[3][32];
+    icon_files_new(paths, 3);
+    struct tray_menu_item menu[4] = {
+        { "A", paths[0], 0, 0, count_item_cb, NULL },
+        { "B", NULL,     0, 0, count_item_cb, NULL },
+        { "C", paths[0], 0, 0, count_item_cb, NULL },
+        { NULL }
+    };
+    struct tray t = { paths[1], "Test", count_tray_cb, menu };
+
+    /* Jobs posted to a window that never pumps again */
+    if (tray_init(&t) < 0) abort();
+    if (!g_icon_posted) {
+        fprintf(stderr, "icon jobs were not posted\n");
+        abort();
+    }
+    tray_exit();
+    if (g_icon_posted) {
+        fprintf(stderr, "tray_exit left posted icon jobs behind\n");
+        abort();
+    }
+    icons_pump();                      /* stale messages are ignored */
+
+    if (tray_init(&t) < 0) abort();
+    icons_pump();
+    TrayContext *ctx = find_ctx_by_tray(&t);
+    HICON shown = ctx->nid.hIcon;
+    if (!shown || icons_pixel(ctx->menu, 0, 12, 3) != 0x80320C30) {
+        fprintf(stderr, "icons were not decoded\n");
+        abort();
+    }
+
+    /* Same tray icon path: nothing to decode */
+    tray_update(&t);
+    if (ctx->notify_job || ctx->nid.hIcon != shown) {
+        fprintf(stderr, "an unchanged tray icon was decoded again\n");
+        abort();
+    }
+
+    /* Checkbox flip: every icon drawn at once, no job */
+    menu[1].checked = 1;
+    tray_update(&t);
+    tray_lock();
+    tray_build_menu(ctx);
+    LeaveCriticalSection(&tray_cs);
+    if (ctx->menu->icon_job || icons_pixel(ctx->menu, 0, 12, 3) != 0x80320C30 ||
+        icons_pixel(ctx->menu, 2, 12, 3) != 0x80320C30) {
+        fprintf(stderr, "a rebuild decoded icons it already had\n");
+        abort();
+    }
+
+    /* One new path: the others stay drawn, only it is decoded */
+    menu[2].icon_path = paths[2];
+    tray_update(&t);
+    tray_lock();
+    tray_build_menu(ctx);
+    LeaveCriticalSection(&tray_cs);
+    if (!ctx->menu->icon_job || ctx->menu->icon_job->count != 2 ||
+        icons_pixel(ctx->menu, 0, 12, 3) != 0x80320C30 || icons_pixel(ctx->menu, 2, 12, 3)) {
+        fprintf(stderr, "a rebuild did not keep the unchanged icons\n");
+        abort();
+    }
+    icons_pump();
+    if (ctx->menu->icon_job || icons_pixel(ctx->menu, 0, 12, 3) != 0x80320C30 ||
+        icons_pixel(ctx->menu, 2, 12, 3) != 0x80320C30) {
+        fprintf(stderr, "the partial rebuild did not deliver\n");
+        abort();
+    }
+    tray_exit();
+    icons_pump();
+
+    /* Fast start decodes the tray icon itself, outside tray_cs */
+    if (tray_init_ex(&t, TRAY_INIT_FAST) < 0) abort();
+    ctx = find_ctx_by_tray(&t);
+    if (!ctx->nid.hIcon || !ctx->icon_path || strcmp(ctx->icon_path->key, paths[1])) {
+        fprintf(stderr, "fast tray_init did not show its icon\n");
+        abort();
+    }
+    tray_exit();
+    icons_pump();
+    icon_files_free(paths, 3);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Driver                                                                    */
+/* -------------------------------------------------------------------------- */
+static const struct { const char *name; void (*fn)(void); } tests[] = {
+    { "handles", test_handles },
+    { "polled",  test_polled  },
+    { "strings", test_strings },
+    { "popup",   test_popup   },
+    { "startup", test_startup },
+    { "trace",   test_trace   },
+    { "atlas",   test_atlas   },
+    { "ico",     test_ico     },
+    { "icons",   test_icons   },
+};
+
+int main(int argc, char **argv)
+{
+    size_t count = sizeof(tests) / sizeof(tests[0]);
+    int ran = 0;
+    for (size_t i = 0; i < count; i++) {
+        int wanted = argc < 2;
+        for (int a = 1; a < argc; a++) wanted |= !strcmp(argv[a], tests[i].name);
+        if (!wanted) continue;
+        tests[i].fn();
+        fprintf(stderr, "ok %s\n", tests[i].name);
+        ran++;
+    }
+    if (ran == 0 || (argc > 1 && ran != argc - 1)) {
+        fprintf(stderr, "usage: %s [NAME]...  (unknown test name)\n", argv[0]);
+        return 2;
+    }
+    return 0;
+}
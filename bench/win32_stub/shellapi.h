@@ -0,0 +1,53 @@
+/* shellapi.h - notification icon subset for the Linux benchmark build */
+#ifndef TRAY_WIN32_STUB_SHELLAPI_H
+#define TRAY_WIN32_STUB_SHELLAPI_H
+
+#include <windows.h>
+
+#define NIF_MESSAGE 0x0001
+#define NIF_ICON    0x0002
+#define NIF_TIP     0x0004
+#define NIM_ADD     0x0000
+#define NIM_MODIFY  0x0001
+#define NIM_DELETE  0x0002
+
+typedef struct {
+    DWORD cbSize;
+    HWND  hWnd;
+    UINT  uID;
+    UINT  uFlags;
+    UINT  uCallbackMessage;
+    HICON hIcon;
+    WCHAR szTip[128];
+    DWORD dwState;
+    DWORD dwStateMask;
+    WCHAR szInfo[256];
+    UINT  uVersion;
+    WCHAR szInfoTitle[64];
+    DWORD dwInfoFlags;
+    GUID  guidItem;
+    HICON hBalloonIcon;
+} NOTIFYICONDATAW;
+
+typedef struct {
+    DWORD cbSize;
+    HWND  hWnd;
+    UINT  uID;
+    GUID  guidItem;
+} NOTIFYICONIDENTIFIER;
+
+static inline BOOL Shell_NotifyIconW(DWORD msg, NOTIFYICONDATAW *nid)
+{
+    (void)msg; (void)nid;
+    return TRUE;
+}
+
+static inline UINT ExtractIconExW(LPCWSTR file, int index, HICON *large, HICON *small, UINT n)
+{
+    (void)file; (void)index; (void)n;
+    if (large) *large = NULL;
+    if (small) *small = NULL;
+    return 0;
+}
+
+#endif /* TRAY_WIN32_STUB_SHELLAPI_H */
@@ -0,0 +1,818 @@
+/* windows.h - minimal Win32 stand-in for building tray_windows.c on Linux
+ *
+ * Only what tray_windows.c touches is declared here. Menus, message
+ * queue, locks and UTF-8 conversion are modelled closely enough that the
+ * benchmark exercises the real control flow; shell and GDI calls are
+ * cheap no-ops. Build with -fshort-wchar so WCHAR/L"" are 16-bit.
+ */
+#ifndef TRAY_WIN32_STUB_WINDOWS_H
+#define TRAY_WIN32_STUB_WINDOWS_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+/* -------------------------------------------------------------------------- */
+/*  Compiler extensions                                                       */
+/* -------------------------------------------------------------------------- */
+#define WINAPI
+#define CALLBACK
+#define __try                     if (1)
+#define __except(filter)          else if (0)
+#define EXCEPTION_EXECUTE_HANDLER 1
+
+/* -------------------------------------------------------------------------- */
+/*  Basic types                                                               */
+/* -------------------------------------------------------------------------- */
+typedef int                BOOL;
+typedef unsigned char      BYTE;
+typedef unsigned short     WORD;
+typedef unsigned int       DWORD;
+typedef unsigned int       UINT;
+typedef int                LONG;
+typedef unsigned int       ULONG;
+typedef long               HRESULT;
+typedef long long          LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef uintptr_t          ULONG_PTR;
+typedef uintptr_t          WPARAM;
+typedef intptr_t           LPARAM;
+typedef intptr_t           LRESULT;
+typedef wchar_t            WCHAR;
+typedef WCHAR             *LPWSTR;
+typedef const WCHAR       *LPCWSTR;
+typedef char              *LPSTR;
+typedef const char        *LPCSTR;
+typedef void              *LPVOID;
+typedef void              *PVOID;
+typedef void              *HANDLE;
+typedef void              *HGDIOBJ;
+typedef void             (*FARPROC)(void);
+
+typedef struct HWND__     *HWND;
+typedef struct HICON__    *HICON;
+typedef struct HBITMAP__  *HBITMAP;
+typedef struct HDC__      *HDC;
+typedef struct HMODULE__  *HMODULE;
+typedef struct HMONITOR__ *HMONITOR;
+typedef struct HBRUSH__   *HBRUSH;
+typedef struct HCURSOR__  *HCURSOR;
+typedef HMODULE            HINSTANCE;
+typedef struct tray_stub_menu *HMENU;
+
+#define TRUE  1
+#define FALSE 0
+
+typedef struct { LONG x, y; } POINT;
+typedef struct { LONG left, top, right, bottom; } RECT;
+typedef struct { DWORD Data1; WORD Data2, Data3; BYTE Data4[8]; } GUID;
+
+#define ZeroMemory(p, n)      memset((p), 0, (n))
+#define SUCCEEDED(hr)         ((HRESULT)(hr) >= 0)
+#define MAKEINTRESOURCEA(i)   ((LPCSTR)(uintptr_t)(WORD)(i))
+#define _TRUNCATE             ((size_t)-1)
+#define ERROR_CLASS_ALREADY_EXISTS 1410
+
+/* -------------------------------------------------------------------------- */
+/*  Messages and window classes                                               */
+/* -------------------------------------------------------------------------- */
+#define WM_DESTROY     0x0002
+#define WM_CLOSE       0x0010
+#define WM_QUIT        0x0012
+#define WM_DRAWITEM    0x002B
+#define WM_MEASUREITEM 0x002C
+#define WM_COMMAND     0x0111
+#define WM_ENTERIDLE   0x0121
+#define WM_MOUSEMOVE   0x0200
+#define WM_LBUTTONUP   0x0202
+#define WM_RBUTTONUP   0x0205
+#define WM_USER        0x0400
+#define MSGF_MENU      2
+#define PM_NOREMOVE    0x0000
+#define PM_REMOVE      0x0001
+
+typedef LRESULT (CALLBACK *WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+
+typedef struct {
+    UINT      cbSize;
+    UINT      style;
+    WNDPROC   lpfnWndProc;
+    int       cbClsExtra;
+    int       cbWndExtra;
+    HINSTANCE hInstance;
+    HICON     hIcon;
+    HCURSOR   hCursor;
+    HBRUSH    hbrBackground;
+    LPCWSTR   lpszMenuName;
+    LPCWSTR   lpszClassName;
+    HICON     hIconSm;
+} WNDCLASSEXW;
+
+typedef struct {
+    HWND   hwnd;
+    UINT   message;
+    WPARAM wParam;
+    LPARAM lParam;
+    DWORD  time;
+    POINT  pt;
+} MSG;
+
+/* -------------------------------------------------------------------------- */
+/*  Menus                                                                     */
+/* -------------------------------------------------------------------------- */
+#define MF_SEPARATOR     0x0800
+#define MFT_STRING       0x0000
+#define MFT_SEPARATOR    0x0800
+#define MFS_DISABLED     0x0003
+#define MFS_CHECKED      0x0008
+#define MIIM_STATE       0x0001
+#define MIIM_ID          0x0002
+#define MIIM_SUBMENU     0x0004
+#define MIIM_DATA        0x0020
+#define MIIM_STRING      0x0040
+#define MIIM_BITMAP      0x0080
+#define MIIM_FTYPE       0x0100
+#define HBMMENU_CALLBACK ((HBITMAP)(intptr_t)-1)
+#define TPM_LEFTALIGN    0x0000
+#define TPM_RIGHTBUTTON  0x0002
+#define TPM_NONOTIFY     0x0080
+#define TPM_RETURNCMD    0x0100
+
+typedef struct {
+    UINT      cbSize;
+    UINT      fMask;
+    UINT      fType;
+    UINT      fState;
+    UINT      wID;
+    HMENU     hSubMenu;
+    HBITMAP   hbmpChecked;
+    HBITMAP   hbmpUnchecked;
+    ULONG_PTR dwItemData;
+    LPWSTR    dwTypeData;
+    UINT      cch;
+    HBITMAP   hbmpItem;
+} MENUITEMINFOW;
+
+/* -------------------------------------------------------------------------- */
+/*  GDI and monitors                                                          */
+/* -------------------------------------------------------------------------- */
+#define BI_RGB                   0
+#define DIB_RGB_COLORS           0
+#define DI_NORMAL                0x0003
+#define IMAGE_BITMAP             0
+#define IMAGE_ICON               1
+#define LR_CREATEDIBSECTION      0x2000
+#define LR_DEFAULTSIZE           0x0040
+#define LR_LOADFROMFILE          0x0010
+#define MONITOR_DEFAULTTOPRIMARY 0x0001
+#define ODT_MENU                 1
+#define SRCCOPY                  0x00CC0020
+#define AC_SRC_OVER              0x00
+#define AC_SRC_ALPHA             0x01
+
+typedef struct {
+    UINT      CtlType;
+    UINT      CtlID;
+    UINT      itemID;
+    UINT      itemWidth;
+    UINT      itemHeight;
+    ULONG_PTR itemData;
+} MEASUREITEMSTRUCT;
+
+typedef struct {
+    UINT      CtlType;
+    UINT      CtlID;
+    UINT      itemID;
+    UINT      itemAction;
+    UINT      itemState;
+    HWND      hwndItem;
+    HDC       hDC;
+    RECT      rcItem;
+    ULONG_PTR itemData;
+} DRAWITEMSTRUCT;
+
+typedef struct {
+    BYTE BlendOp;
+    BYTE BlendFlags;
+    BYTE SourceConstantAlpha;
+    BYTE AlphaFormat;
+} BLENDFUNCTION;
+
+typedef struct {
+    DWORD biSize;
+    LONG  biWidth;
+    LONG  biHeight;
+    WORD  biPlanes;
+    WORD  biBitCount;
+    DWORD biCompression;
+    DWORD biSizeImage;
+    LONG  biXPelsPerMeter;
+    LONG  biYPelsPerMeter;
+    DWORD biClrUsed;
+    DWORD biClrImportant;
+} BITMAPINFOHEADER;
+
+typedef struct {
+    BITMAPINFOHEADER bmiHeader;
+    DWORD            bmiColors[1];
+} BITMAPINFO;
+
+typedef struct {
+    DWORD cbSize;
+    RECT  rcMonitor;
+    RECT  rcWork;
+    DWORD dwFlags;
+} MONITORINFO;
+
+/* -------------------------------------------------------------------------- */
+/*  Critical sections (recursive, like the real thing)                        */
+/* -------------------------------------------------------------------------- */
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+static inline void InitializeCriticalSection(CRITICAL_SECTION *cs)
+{
+    pthread_mutexattr_t a;
+    pthread_mutexattr_init(&a);
+    pthread_mutexattr_settype(&a, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(cs, &a);
+    pthread_mutexattr_destroy(&a);
+}
+static inline void DeleteCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_destroy(cs); }
+static inline void EnterCriticalSection(CRITICAL_SECTION *cs)  { pthread_mutex_lock(cs); }
+static inline void LeaveCriticalSection(CRITICAL_SECTION *cs)  { pthread_mutex_unlock(cs); }
+static inline BOOL TryEnterCriticalSection(CRITICAL_SECTION *cs) { return pthread_mutex_trylock(cs) == 0; }
+
+/* Thread-local storage */
+#define TLS_OUT_OF_INDEXES ((DWORD)0xFFFFFFFF)
+
+static inline DWORD TlsAlloc(void)
+{
+    pthread_key_t k;
+    return pthread_key_create(&k, NULL) == 0 ? (DWORD)k : TLS_OUT_OF_INDEXES;
+}
+static inline void *TlsGetValue(DWORD i)          { return pthread_getspecific((pthread_key_t)i); }
+static inline BOOL  TlsSetValue(DWORD i, void *v) { return pthread_setspecific((pthread_key_t)i, v) == 0; }
+static inline BOOL  TlsFree(DWORD i)               { return pthread_key_delete((pthread_key_t)i) == 0; }
+
+static inline void Sleep(DWORD ms)
+{
+    if (ms) usleep((useconds_t)ms * 1000);
+    else    sched_yield();
+}
+
+static inline DWORD GetCurrentProcessId(void) { return (DWORD)getpid(); }
+
+static inline DWORD GetCurrentThreadId(void)
+{
+    return (DWORD)(uintptr_t)pthread_self();
+}
+
+static inline DWORD GetLastError(void) { return 0; }
+
+static inline LONG InterlockedIncrement(volatile LONG *p)        { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedDecrement(volatile LONG *p)        { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedExchange(volatile LONG *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+static inline LONG InterlockedCompareExchange(volatile LONG *p, LONG v, LONG cmp)
+{
+    __atomic_compare_exchange_n(p, &cmp, v, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return cmp;   /* initial value, as on Windows */
+}
+
+/* One-time initialisation: 0 = not started, 1 = running, 2 = done */
+typedef struct { volatile LONG state; } INIT_ONCE, *PINIT_ONCE;
+#define INIT_ONCE_STATIC_INIT { 0 }
+typedef BOOL (CALLBACK *PINIT_ONCE_FN)(PINIT_ONCE, void *, void **);
+
+static inline BOOL InitOnceExecuteOnce(PINIT_ONCE o, PINIT_ONCE_FN fn, void *param, void **ctx)
+{
+    if (__atomic_load_n(&o->state, __ATOMIC_ACQUIRE) == 2) return TRUE;
+    if (InterlockedCompareExchange(&o->state, 1, 0) == 0) {
+        BOOL ok = fn(o, param, ctx);
+        __atomic_store_n(&o->state, ok ? 2 : 0, __ATOMIC_RELEASE);
+        return ok;
+    }
+    while (__atomic_load_n(&o->state, __ATOMIC_ACQUIRE) == 1) sched_yield();
+    return __atomic_load_n(&o->state, __ATOMIC_ACQUIRE) == 2;
+}
+
+typedef union { struct { DWORD LowPart; LONG HighPart; } u; long long QuadPart; } LARGE_INTEGER;
+
+static inline BOOL QueryPerformanceCounter(LARGE_INTEGER *c)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    c->QuadPart = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    return TRUE;
+}
+static inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *f) { f->QuadPart = 1000000000LL; return TRUE; }
+
+static inline ULONGLONG GetTickCount64(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000 + (ULONGLONG)ts.tv_nsec / 1000000;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Thread pool (work runs inline; results still travel via PostMessageW)     */
+/* -------------------------------------------------------------------------- */
+typedef struct TP_CALLBACK_INSTANCE *PTP_CALLBACK_INSTANCE;
+typedef struct TP_CALLBACK_ENVIRON  *PTP_CALLBACK_ENVIRON;
+typedef void (CALLBACK *PTP_SIMPLE_CALLBACK)(PTP_CALLBACK_INSTANCE, void *);
+
+static inline BOOL TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK cb, void *ctx,
+                                               PTP_CALLBACK_ENVIRON env)
+{
+    (void)env;
+    cb(NULL, ctx);
+    return TRUE;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Wide strings (16-bit under -fshort-wchar, so libc wcs* cannot be used)    */
+/* -------------------------------------------------------------------------- */
+static inline size_t tray_stub_wcslen(const WCHAR *s)
+{
+    const WCHAR *p = s;
+    while (*p) p++;
+    return (size_t)(p - s);
+}
+#define wcslen tray_stub_wcslen
+
+static inline int wcsncpy_s(WCHAR *dst, size_t dst_len, const WCHAR *src, size_t count)
+{
+    size_t n = 0;
+    if (!dst || !dst_len) return 22;
+    while (src[n] && n + 1 < dst_len && (count == _TRUNCATE || n < count)) {
+        dst[n] = src[n];
+        n++;
+    }
+    dst[n] = 0;
+    return 0;
+}
+
+#define CP_UTF8 65001
+
+/* UTF-8 → UTF-16, same contract as the Win32 call for cbMultiByte == -1 */
+static inline int MultiByteToWideChar(UINT cp, DWORD flags, LPCSTR src, int srclen,
+                                      LPWSTR dst, int dstlen)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    int n = 0;
+    (void)cp; (void)flags; (void)srclen;
+    for (;;) {
+        unsigned int c = *s++;
+        if (c >= 0xF0)      { c = ((c & 0x07) << 18) | ((s[0] & 0x3F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F); s += 3; }
+        else if (c >= 0xE0) { c = ((c & 0x0F) << 12) | ((s[0] & 0x3F) << 6) | (s[1] & 0x3F); s += 2; }
+        else if (c >= 0xC0) { c = ((c & 0x1F) << 6) | (s[0] & 0x3F); s += 1; }
+        int units = c >= 0x10000 ? 2 : 1;
+        if (dst) {
+            if (n + units > dstlen) return 0;
+            if (units == 2) {
+                c -= 0x10000;
+                dst[n]     = (WCHAR)(0xD800 + (c >> 10));
+                dst[n + 1] = (WCHAR)(0xDC00 + (c & 0x3FF));
+            } else {
+                dst[n] = (WCHAR)c;
+            }
+        }
+        n += units;
+        if (!c) return n;
+    }
+}
+
+/* UTF-16 → UTF-8, same contract as the Win32 call for cchWideChar == -1 */
+static inline int WideCharToMultiByte(UINT cp, DWORD flags, LPCWSTR src, int srclen,
+                                      LPSTR dst, int dstlen, LPCSTR def, BOOL *used)
+{
+    int n = 0;
+    (void)cp; (void)flags; (void)srclen; (void)def; (void)used;
+    for (;;) {
+        unsigned int c = *src++;
+        if (c >= 0xD800 && c < 0xDC00) c = 0x10000 + ((c - 0xD800) << 10) + (*src++ - 0xDC00);
+        unsigned char buf[4];
+        int len;
+        if (c < 0x80)         { buf[0] = (unsigned char)c; len = 1; }
+        else if (c < 0x800)   { buf[0] = 0xC0 | (c >> 6); buf[1] = 0x80 | (c & 0x3F); len = 2; }
+        else if (c < 0x10000) { buf[0] = 0xE0 | (c >> 12); buf[1] = 0x80 | ((c >> 6) & 0x3F); buf[2] = 0x80 | (c & 0x3F); len = 3; }
+        else                  { buf[0] = 0xF0 | (c >> 18); buf[1] = 0x80 | ((c >> 12) & 0x3F); buf[2] = 0x80 | ((c >> 6) & 0x3F); buf[3] = 0x80 | (c & 0x3F); len = 4; }
+        if (dst) {
+            if (n + len > dstlen) return 0;
+            memcpy(dst + n, buf, (size_t)len);
+        }
+        n += len;
+        if (!c) return n;
+    }
+}
+
+/* CRT wide fopen: the path is converted back to UTF-8 for libc */
+static inline FILE *_wfopen(const WCHAR *path, const WCHAR *mode)
+{
+    char p[1024], m[8];
+    if (!WideCharToMultiByte(CP_UTF8, 0, path, -1, p, (int)sizeof(p), NULL, NULL) ||
+        !WideCharToMultiByte(CP_UTF8, 0, mode, -1, m, (int)sizeof(m), NULL, NULL))
+        return NULL;
+    return fopen(p, m);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Files and read-only mappings (fd + 1 as the handle, mmap for views)       */
+/* -------------------------------------------------------------------------- */
+#define GENERIC_READ          0x80000000u
+#define FILE_SHARE_READ       0x00000001
+#define OPEN_EXISTING         3
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define PAGE_READONLY         0x02
+#define FILE_MAP_READ         0x0004
+#define INVALID_HANDLE_VALUE  ((HANDLE)(intptr_t)-1)
+
+static inline HANDLE CreateFileW(LPCWSTR path, DWORD access, DWORD share, void *sa,
+                                 DWORD disposition, DWORD flags, HANDLE tmpl)
+{
+    char p[1024];
+    (void)access; (void)share; (void)sa; (void)disposition; (void)flags; (void)tmpl;
+    if (!WideCharToMultiByte(CP_UTF8, 0, path, -1, p, (int)sizeof(p), NULL, NULL))
+        return INVALID_HANDLE_VALUE;
+    int fd = open(p, O_RDONLY);
+    return fd < 0 ? INVALID_HANDLE_VALUE : (HANDLE)(intptr_t)(fd + 1);
+}
+
+static inline BOOL GetFileSizeEx(HANDLE f, LARGE_INTEGER *size)
+{
+    struct stat st;
+    if (fstat((int)(intptr_t)f - 1, &st) != 0) return FALSE;
+    size->QuadPart = (long long)st.st_size;
+    return TRUE;
+}
+
+static inline HANDLE CreateFileMappingW(HANDLE f, void *sa, DWORD protect,
+                                        DWORD size_hi, DWORD size_lo, LPCWSTR name)
+{
+    (void)sa; (void)protect; (void)size_hi; (void)size_lo; (void)name;
+    int fd = dup((int)(intptr_t)f - 1);
+    return fd < 0 ? NULL : (HANDLE)(intptr_t)(fd + 1);
+}
+
+static inline BOOL CloseHandle(HANDLE h) { return close((int)(intptr_t)h - 1) == 0; }
+
+/* Views remember their length for munmap */
+static struct { void *addr; size_t len; } tray_stub_views[64];
+static pthread_mutex_t tray_stub_views_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void *MapViewOfFile(HANDLE map, DWORD access, DWORD off_hi, DWORD off_lo, size_t n)
+{
+    struct stat st;
+    int fd = (int)(intptr_t)map - 1;
+    (void)access; (void)off_hi; (void)off_lo; (void)n;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) return NULL;
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) return NULL;
+    pthread_mutex_lock(&tray_stub_views_lock);
+    for (int i = 0; i < 64; i++) {
+        if (!tray_stub_views[i].addr) {
+            tray_stub_views[i].addr = addr;
+            tray_stub_views[i].len  = (size_t)st.st_size;
+            pthread_mutex_unlock(&tray_stub_views_lock);
+            return addr;
+        }
+    }
+    pthread_mutex_unlock(&tray_stub_views_lock);
+    munmap(addr, (size_t)st.st_size);
+    return NULL;
+}
+
+static inline BOOL UnmapViewOfFile(const void *addr)
+{
+    pthread_mutex_lock(&tray_stub_views_lock);
+    for (int i = 0; i < 64; i++) {
+        if (tray_stub_views[i].addr == addr) {
+            munmap(tray_stub_views[i].addr, tray_stub_views[i].len);
+            tray_stub_views[i].addr = NULL;
+            pthread_mutex_unlock(&tray_stub_views_lock);
+            return TRUE;
+        }
+    }
+    pthread_mutex_unlock(&tray_stub_views_lock);
+    return FALSE;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Menu model                                                                */
+/* -------------------------------------------------------------------------- */
+typedef struct {
+    UINT      id, type, state;
+    ULONG_PTR data;
+    HMENU     sub;
+    HBITMAP   bmp;
+    WCHAR    *text;
+} tray_stub_menu_item;
+
+struct tray_stub_menu {
+    tray_stub_menu_item *items;
+    int                  count, cap;
+};
+
+static inline HMENU CreatePopupMenu(void)
+{
+    return (HMENU)calloc(1, sizeof(struct tray_stub_menu));
+}
+
+static inline BOOL DestroyMenu(HMENU m)
+{
+    if (!m) return FALSE;
+    for (int i = 0; i < m->count; i++) {
+        if (m->items[i].sub) DestroyMenu(m->items[i].sub);
+        free(m->items[i].text);
+    }
+    free(m->items);
+    free(m);
+    return TRUE;
+}
+
+static inline int GetMenuItemCount(HMENU m) { return m ? m->count : -1; }
+
+static inline tray_stub_menu_item *tray_stub_find(HMENU m, UINT item, BOOL byPos)
+{
+    if (!m) return NULL;
+    if (byPos) return item < (UINT)m->count ? &m->items[item] : NULL;
+    for (int i = 0; i < m->count; i++) {
+        if (m->items[i].id == item && !(m->items[i].type & MFT_SEPARATOR)) return &m->items[i];
+        if (m->items[i].sub) {
+            tray_stub_menu_item *r = tray_stub_find(m->items[i].sub, item, FALSE);
+            if (r) return r;
+        }
+    }
+    return NULL;
+}
+
+static inline void tray_stub_apply(tray_stub_menu_item *it, const MENUITEMINFOW *mi)
+{
+    if (mi->fMask & MIIM_ID)      it->id    = mi->wID;
+    if (mi->fMask & MIIM_FTYPE)   it->type  = mi->fType;
+    if (mi->fMask & MIIM_STATE)   it->state = mi->fState;
+    if (mi->fMask & MIIM_DATA)    it->data  = mi->dwItemData;
+    if (mi->fMask & MIIM_SUBMENU) it->sub   = mi->hSubMenu;
+    if (mi->fMask & MIIM_BITMAP)  it->bmp   = mi->hbmpItem;
+    if (mi->fMask & MIIM_STRING) {
+        free(it->text);
+        it->text = NULL;
+        if (mi->dwTypeData) {
+            size_t n = wcslen(mi->dwTypeData) + 1;
+            it->text = (WCHAR *)malloc(n * sizeof(WCHAR));
+            if (it->text) memcpy(it->text, mi->dwTypeData, n * sizeof(WCHAR));
+        }
+    }
+}
+
+static inline BOOL InsertMenuItemW(HMENU m, UINT item, BOOL byPos, const MENUITEMINFOW *mi)
+{
+    (void)item; (void)byPos; /* tray_windows.c only appends */
+    if (!m) return FALSE;
+    if (m->count == m->cap) {
+        int cap = m->cap ? m->cap * 2 : 8;
+        tray_stub_menu_item *p = (tray_stub_menu_item *)realloc(m->items, (size_t)cap * sizeof(*p));
+        if (!p) return FALSE;
+        m->items = p;
+        m->cap   = cap;
+    }
+    tray_stub_menu_item *it = &m->items[m->count++];
+    memset(it, 0, sizeof(*it));
+    tray_stub_apply(it, mi);
+    return TRUE;
+}
+
+static inline BOOL AppendMenuW(HMENU m, UINT flags, ULONG_PTR id, LPCWSTR text)
+{
+    MENUITEMINFOW mi;
+    memset(&mi, 0, sizeof(mi));
+    mi.fMask      = MIIM_FTYPE | MIIM_ID | MIIM_STRING;
+    mi.fType      = flags & MF_SEPARATOR;
+    mi.wID        = (UINT)id;
+    mi.dwTypeData = (LPWSTR)text;
+    return InsertMenuItemW(m, (UINT)-1, TRUE, &mi);
+}
+
+static inline BOOL GetMenuItemInfoW(HMENU m, UINT item, BOOL byPos, MENUITEMINFOW *mi)
+{
+    tray_stub_menu_item *it = tray_stub_find(m, item, byPos);
+    if (!it) return FALSE;
+    if (mi->fMask & MIIM_ID)      mi->wID        = it->id;
+    if (mi->fMask & MIIM_FTYPE)   mi->fType      = it->type;
+    if (mi->fMask & MIIM_STATE)   mi->fState     = it->state;
+    if (mi->fMask & MIIM_DATA)    mi->dwItemData = it->data;
+    if (mi->fMask & MIIM_SUBMENU) mi->hSubMenu   = it->sub;
+    if (mi->fMask & MIIM_BITMAP)  mi->hbmpItem   = it->bmp;
+    return TRUE;
+}
+
+static inline BOOL SetMenuItemInfoW(HMENU m, UINT item, BOOL byPos, const MENUITEMINFOW *mi)
+{
+    tray_stub_menu_item *it = tray_stub_find(m, item, byPos);
+    if (!it) return FALSE;
+    tray_stub_apply(it, mi);
+    return TRUE;
+}
+
+/* Set by the benchmark to act while the popup is "open"; returns the
+   chosen command (TPM_RETURNCMD), 0 = dismissed */
+static UINT (*tray_stub_popup_hook)(HMENU m);
+
+static inline BOOL TrackPopupMenu(HMENU m, UINT flags, int x, int y, int r, HWND h, const RECT *rc)
+{
+    (void)flags; (void)x; (void)y; (void)r; (void)h; (void)rc;
+    return tray_stub_popup_hook ? (BOOL)tray_stub_popup_hook(m) : 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Windows and the message queue                                             */
+/* -------------------------------------------------------------------------- */
+static WNDPROC   tray_stub_wndproc;
+static uintptr_t tray_stub_next_hwnd = 0x100;
+static MSG       tray_stub_queue[256];
+static unsigned  tray_stub_q_head, tray_stub_q_tail;
+
+static inline HMODULE GetModuleHandleW(LPCWSTR name) { (void)name; return (HMODULE)(uintptr_t)0x400000; }
+static inline HMODULE LoadLibraryW(LPCWSTR name)     { (void)name; return NULL; }
+static inline FARPROC GetProcAddress(HMODULE m, LPCSTR name) { (void)m; (void)name; return NULL; }
+static inline UINT    RegisterWindowMessageW(LPCWSTR name)   { (void)name; return 0xC100; }
+
+static inline WORD RegisterClassExW(const WNDCLASSEXW *wc)
+{
+    tray_stub_wndproc = wc->lpfnWndProc;
+    return 1;
+}
+static inline BOOL UnregisterClassW(LPCWSTR name, HINSTANCE inst) { (void)name; (void)inst; return TRUE; }
+
+static inline HWND CreateWindowExW(DWORD ex, LPCWSTR cls, LPCWSTR title, DWORD style,
+                                   int x, int y, int w, int h, HWND parent, HMENU menu,
+                                   HINSTANCE inst, LPVOID param)
+{
+    (void)ex; (void)cls; (void)title; (void)style; (void)x; (void)y; (void)w; (void)h;
+    (void)parent; (void)menu; (void)inst; (void)param;
+    return (HWND)(tray_stub_next_hwnd++);
+}
+static inline BOOL DestroyWindow(HWND h) { (void)h; return TRUE; }
+
+static inline LRESULT DefWindowProcW(HWND h, UINT msg, WPARAM w, LPARAM l)
+{
+    (void)h; (void)msg; (void)w; (void)l;
+    return 0;
+}
+
+static inline LRESULT SendMessageW(HWND h, UINT msg, WPARAM w, LPARAM l)
+{
+    return tray_stub_wndproc ? tray_stub_wndproc(h, msg, w, l) : 0;
+}
+#define SendMessage SendMessageW
+
+static inline BOOL PostMessageW(HWND h, UINT msg, WPARAM w, LPARAM l)
+{
+    if (tray_stub_q_tail - tray_stub_q_head == 256) return FALSE;
+    MSG *m = &tray_stub_queue[tray_stub_q_tail++ % 256];
+    memset(m, 0, sizeof(*m));
+    m->hwnd = h; m->message = msg; m->wParam = w; m->lParam = l;
+    return TRUE;
+}
+static inline void PostQuitMessage(int code) { PostMessageW(NULL, WM_QUIT, (WPARAM)code, 0); }
+
+static inline BOOL PeekMessageW(MSG *m, HWND h, UINT lo, UINT hi, UINT flags)
+{
+    (void)h; (void)lo; (void)hi;
+    if (tray_stub_q_head == tray_stub_q_tail) return FALSE;
+    *m = tray_stub_queue[tray_stub_q_head % 256];
+    if (flags & PM_REMOVE) tray_stub_q_head++;
+    return TRUE;
+}
+static inline BOOL GetMessageW(MSG *m, HWND h, UINT lo, UINT hi)
+{
+    /* Nothing can arrive later in a single-threaded harness: treat empty as quit */
+    if (!PeekMessageW(m, h, lo, hi, PM_REMOVE)) return 0;
+    return m->message == WM_QUIT ? 0 : 1;
+}
+static inline BOOL    TranslateMessage(const MSG *m) { (void)m; return FALSE; }
+static inline LRESULT DispatchMessageW(const MSG *m)
+{
+    return tray_stub_wndproc ? tray_stub_wndproc(m->hwnd, m->message, m->wParam, m->lParam) : 0;
+}
+
+static inline BOOL GetCursorPos(POINT *p)       { p->x = 0; p->y = 0; return TRUE; }
+static inline BOOL SetForegroundWindow(HWND h)  { (void)h; return TRUE; }
+static inline HWND FindWindowW(LPCWSTR c, LPCWSTR t) { (void)c; (void)t; return NULL; }
+static inline HWND FindWindowExW(HWND p, HWND a, LPCWSTR c, LPCWSTR t) { (void)p; (void)a; (void)c; (void)t; return NULL; }
+static inline BOOL GetWindowRect(HWND h, RECT *r) { (void)h; (void)r; return FALSE; }
+
+static inline HMONITOR MonitorFromRect(const RECT *r, DWORD f) { (void)r; (void)f; return (HMONITOR)(uintptr_t)1; }
+static inline HMONITOR MonitorFromWindow(HWND h, DWORD f)      { (void)h; (void)f; return (HMONITOR)(uintptr_t)1; }
+static inline BOOL GetMonitorInfoW(HMONITOR m, MONITORINFO *mi)
+{
+    (void)m;
+    mi->rcMonitor.left = 0; mi->rcMonitor.top = 0;
+    mi->rcMonitor.right = 1920; mi->rcMonitor.bottom = 1080;
+    mi->rcWork = mi->rcMonitor;
+    return TRUE;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  GDI / icons (LoadImageW decodes nothing in the harness)                   */
+/* -------------------------------------------------------------------------- */
+static inline HANDLE LoadImageW(HINSTANCE i, LPCWSTR name, UINT type, int cx, int cy, UINT f)
+{
+    (void)i; (void)name; (void)type; (void)cx; (void)cy; (void)f;
+    return NULL;
+}
+static inline BOOL DestroyIcon(HICON h)     { (void)h; return TRUE; }
+
+typedef struct {
+    BOOL    fIcon;
+    DWORD   xHotspot, yHotspot;
+    HBITMAP hbmMask, hbmColor;
+} ICONINFO;
+
+#define LOGPIXELSY 90
+
+static inline int   GetDeviceCaps(HDC d, int index) { (void)d; (void)index; return 96; }
+static inline int   MulDiv(int a, int b, int c)     { return (int)(((long long)a * b + c / 2) / c); }
+static inline HICON CreateIconIndirect(ICONINFO *ii) { (void)ii; return (HICON)(uintptr_t)4; }
+static inline HBITMAP CreateBitmap(int w, int h, UINT planes, UINT bpp, const void *bits)
+{
+    (void)w; (void)h; (void)planes; (void)bpp; (void)bits;
+    return (HBITMAP)(uintptr_t)5;
+}
+
+/* DIB sections own real pixels, so atlas pages can be decoded into and read
+   back; the table maps each handle to its bits */
+static struct { HBITMAP bmp; void *bits; } tray_stub_dibs[256];
+static pthread_mutex_t tray_stub_dibs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline BOOL DeleteObject(HGDIOBJ h)
+{
+    pthread_mutex_lock(&tray_stub_dibs_lock);
+    for (int i = 0; i < 256; i++) {
+        if (h && tray_stub_dibs[i].bmp == (HBITMAP)h) {
+            free(tray_stub_dibs[i].bits);
+            tray_stub_dibs[i].bmp  = NULL;
+            tray_stub_dibs[i].bits = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tray_stub_dibs_lock);
+    return TRUE;
+}
+static inline HDC  GetDC(HWND h)            { (void)h; return (HDC)(uintptr_t)1; }
+static inline int  ReleaseDC(HWND h, HDC d) { (void)h; (void)d; return 1; }
+static inline HDC  CreateCompatibleDC(HDC d){ (void)d; return (HDC)(uintptr_t)2; }
+static inline BOOL DeleteDC(HDC d)          { (void)d; return TRUE; }
+static inline HGDIOBJ SelectObject(HDC d, HGDIOBJ o) { (void)d; (void)o; return NULL; }
+static inline HBITMAP CreateDIBSection(HDC d, const BITMAPINFO *bi, UINT u, void **bits,
+                                       HANDLE s, DWORD off)
+{
+    (void)d; (void)u; (void)s; (void)off;
+    LONG w = bi->bmiHeader.biWidth, h = bi->bmiHeader.biHeight;
+    if (h < 0) h = -h;
+    void *p = calloc((size_t)w * (size_t)h, 4);
+    if (!p) return NULL;
+    pthread_mutex_lock(&tray_stub_dibs_lock);
+    for (int i = 0; i < 256; i++) {
+        if (!tray_stub_dibs[i].bmp) {
+            tray_stub_dibs[i].bmp  = (HBITMAP)((char *)p + 1);   /* unique, never dereferenced */
+            tray_stub_dibs[i].bits = p;
+            pthread_mutex_unlock(&tray_stub_dibs_lock);
+            *bits = p;
+            return tray_stub_dibs[i].bmp;
+        }
+    }
+    pthread_mutex_unlock(&tray_stub_dibs_lock);
+    free(p);
+    return NULL;
+}
+static inline BOOL GdiFlush(void) { return TRUE; }
+static inline BOOL BitBlt(HDC d, int x, int y, int cx, int cy, HDC s, int sx, int sy, DWORD rop)
+{
+    (void)d; (void)x; (void)y; (void)cx; (void)cy; (void)s; (void)sx; (void)sy; (void)rop;
+    return TRUE;
+}
+static inline BOOL AlphaBlend(HDC d, int x, int y, int cx, int cy, HDC s, int sx, int sy,
+                              int scx, int scy, BLENDFUNCTION bf)
+{
+    (void)d; (void)x; (void)y; (void)cx; (void)cy; (void)s; (void)sx; (void)sy;
+    (void)scx; (void)scy; (void)bf;
+    return TRUE;
+}
+static inline BOOL DrawIconEx(HDC d, int x, int y, HICON i, int cx, int cy, UINT step,
+                              HBRUSH b, UINT f)
+{
+    (void)d; (void)x; (void)y; (void)i; (void)cx; (void)cy; (void)step; (void)b; (void)f;
+    return TRUE;
+}
+
+#endif /* TRAY_WIN32_STUB_WINDOWS_H */
@@ -37,6 +37,46 @@ struct tray {
     struct tray_menu_item   *menu;               /* Root menu                   */
 };
 
+struct tray_event {
+    unsigned int        tray_id;   /* tray_get_id() of the source tray      */
+    int                 item;      /* item handle, 0 for tray icon clicks   */
+    int                 kind;      /* TRAY_EVENT_*                          */
+    int                 x, y;      /* cursor position (screen coordinates)  */
+    unsigned long long  timestamp; /* milliseconds since system start       */
+};
+
+#define TRAY_EVENT_CLICK      1    /* left click on the tray icon           */
+#define TRAY_EVENT_MENU_ITEM  2    /* menu item chosen                      */
+
+struct tray_startup_timings {       /* milliseconds, per tray_init phase      */
+    double dark_mode_ms;            /* uxtheme dark-mode opt-in               */
+    double register_ms;             /* window class registration              */
+    double window_ms;               /* hidden message window creation         */
+    double icon_ms;                 /* NIM_ADD (+ icon decode in fast mode)   */
+    double menu_ms;                 /* first menu build                       */
+    double visible_ms;              /* tray_init entry → icon added           */
+    double total_ms;                /* tray_init entry → menu ready           */
+};
+
+struct tray_menu_latency {          /* click → popup visible, milliseconds    */
+    unsigned int count;             /* popups measured                        */
+    unsigned int cold;              /* popups that had to build the menu      */
+    double last_ms;
+    double min_ms;
+    double max_ms;
+    double avg_ms;
+};
+
+struct tray_string_stats {          /* interned UTF-16 labels and paths       */
+    unsigned int hits;              /* served without conversion              */
+    unsigned int misses;            /* converted (and cached if they fit)     */
+    unsigned int evictions;         /* dropped least recently used            */
+    unsigned int entries;           /* cached now                             */
+    unsigned int bytes;             /* cached now, bounded at 256 KiB         */
+};
+
+#define TRAY_INIT_FAST  0x1         /* show the icon first, defer the rest    */
+
 struct tray_menu_item {
     char *text;
     char *icon_path;     // Path to icon file (PNG, ICO, etc.)
@@ -52,10 +92,71 @@ struct tray_menu_item {
 TRAY_EXPORT struct tray *tray_get_instance(void);
 
 TRAY_EXPORT int  tray_init (struct tray *tray);
+TRAY_EXPORT int  tray_init_ex(struct tray *tray, unsigned int flags); /* TRAY_INIT_* */
 TRAY_EXPORT int  tray_loop (int blocking);       /* 0 = still running, -1 = finished */
 TRAY_EXPORT void tray_update(struct tray *tray); /* Refresh menu/info           */
 TRAY_EXPORT void tray_exit (void);               /* Free all resources          */
 
+/* tray_update may run on any thread and does not wait for an open menu:
+ * that menu keeps the items it was opened with. Their cb pointers are
+ * copied when the menu is built, so the library never reads a replaced
+ * array, but a pick still hands the item pointer from that array to its
+ * cb. If callbacks use their argument, keep a replaced array alive until
+ * the tray thread returns from the tray_loop() call that was running when
+ * tray_update was called. cb changes take effect with the next tray_update. */
+
+/* Startup phases of the calling thread's tray. With TRAY_INIT_FAST the icon
+ * and tooltip are added at once; dark mode and the menu follow on the first
+ * idle tray_loop() or the first click, so menu_ms/total_ms stay 0 until then. */
+TRAY_EXPORT int tray_get_startup_timings(struct tray_startup_timings *out); /* 0 = ok */
+
+/* Menu changes from tray_update are built when the pointer hovers the icon
+ * (or at the latest on click); this reports how long popups took to appear. */
+TRAY_EXPORT int tray_get_menu_latency(struct tray_menu_latency *out);       /* 0 = ok */
+
+/* Labels, tooltips and icon paths are converted to UTF-16 once and reused
+ * across updates; these counters show how well that works. */
+TRAY_EXPORT int tray_get_string_stats(struct tray_string_stats *out);       /* 0 = ok */
+
+/* Targeted item updates (patch the live menu without a full tray_update).
+ * A handle stays valid across tray_update calls that keep the menu layout
+ * (positions of items, separators, empty-text entries, which are left
+ * out, and submenus), even with new item arrays. Once the layout changes, older handles and tray_event.item
+ * values are rejected with -1; look them up again. Text set here is not
+ * copied back into the item struct, so a later tray_update restores
+ * item->text. These calls build pending tray_update changes of the tray
+ * they target; after tray_init_ex(TRAY_INIT_FAST) they fail until the
+ * deferred menu build has run on the tray thread. */
+TRAY_EXPORT int tray_item_get_handle (struct tray_menu_item *item); /* -1 if not in menu */
+TRAY_EXPORT int tray_item_set_checked(int handle, int checked);    /* 0 = ok, -1 = error */
+TRAY_EXPORT int tray_item_set_enabled(int handle, int enabled);
+TRAY_EXPORT int tray_item_set_text   (int handle, const char *text);
+
+/* Polled events: after tray_set_event_mode(1), every left click on the tray
+ * icon and every chosen menu item is queued, whether or not it has a cb, and
+ * the host drains them in batches; cb pointers are never invoked, so items
+ * need none. A NULL tray cb still opens the menu on left click as well.
+ * Call before tray_init. The queue holds 1024 events; further ones are
+ * dropped and counted. */
+TRAY_EXPORT int          tray_get_id(struct tray *tray);     /* -1 if unknown       */
+TRAY_EXPORT void         tray_set_event_mode(int polled);    /* 1 = queue, 0 = cb   */
+TRAY_EXPORT int          tray_poll_events(struct tray_event *buf, int max); /* count */
+TRAY_EXPORT unsigned int tray_get_dropped_events(void);
+
+/* Timeline tracing (off by default): spans for tray_init, tray_update, menu
+ * builds, icon loads, Shell_NotifyIconW, tray_loop dispatch, callbacks and
+ * waits on the internal lock, written as Chrome trace-event JSON (load in
+ * chrome://tracing or Perfetto). ts/dur are QueryPerformanceCounter
+ * microseconds, the clock System.nanoTime uses on Windows. Spans are
+ * buffered per thread (about 80 KB per 1024 spans) and written on stop, so
+ * recording never does I/O; the sink receives consecutive chunks of one JSON
+ * document, from tray_trace_start and tray_trace_stop only, and must not call
+ * back into the library. */
+typedef void (*tray_trace_sink)(const char *json, unsigned int len, void *user);
+TRAY_EXPORT int  tray_trace_start(const char *path);                      /* 0 = ok */
+TRAY_EXPORT int  tray_trace_start_sink(tray_trace_sink sink, void *user); /* 0 = ok */
+TRAY_EXPORT void tray_trace_stop(void);                 /* flush, close the JSON */
+
 /* Notification area information */
 TRAY_EXPORT int tray_get_notification_icons_position(int *x, int *y);
 TRAY_EXPORT const char *tray_get_notification_icons_region(void);
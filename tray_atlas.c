@@ -0,0 +1,68 @@
+/* tray_atlas.c - shelf packing for menu icon atlases */
+#include <stdlib.h>
+#include "tray_atlas.h"
+
+typedef struct {
+    int h, w, index;
+} atlas_order;
+
+/* Tallest first, then widest, then original order so results are stable */
+static int atlas_order_cmp(const void *a, const void *b)
+{
+    const atlas_order *l = (const atlas_order *)a;
+    const atlas_order *r = (const atlas_order *)b;
+    if (l->h != r->h) return r->h - l->h;
+    if (l->w != r->w) return r->w - l->w;
+    return l->index - r->index;
+}
+
+int tray_atlas_pack(tray_atlas_rect *rects, int count, int page_w, int page_h)
+{
+    if (count <= 0) return 0;
+
+    atlas_order *order = (atlas_order *)malloc((size_t)count * sizeof(*order));
+    if (!order) return -1;
+    for (int i = 0; i < count; i++) {
+        order[i].h     = rects[i].h;
+        order[i].w     = rects[i].w;
+        order[i].index = i;
+    }
+    qsort(order, (size_t)count, sizeof(*order), atlas_order_cmp);
+
+    int page = 0, x = 0, y = 0, shelf_h = 0, used = 0;
+    for (int i = 0; i < count; i++) {
+        tray_atlas_rect *r = &rects[order[i].index];
+        if (r->w <= 0 || r->h <= 0 || r->w > page_w || r->h > page_h) {
+            r->page = -1;
+            continue;
+        }
+        if (x + r->w > page_w) {                 /* next shelf */
+            x = 0;
+            y += shelf_h;
+            shelf_h = 0;
+        }
+        if (y + r->h > page_h) {                 /* next page */
+            page++;
+            x = y = shelf_h = 0;
+        }
+        r->x    = x;
+        r->y    = y;
+        r->page = page;
+        used    = page + 1;
+        x += r->w;
+        if (r->h > shelf_h) shelf_h = r->h;
+    }
+
+    free(order);
+    return used;
+}
+
+int tray_atlas_page_height(const tray_atlas_rect *rects, int count, int page)
+{
+    int h = 0;
+    for (int i = 0; i < count; i++) {
+        if (rects[i].page == page && rects[i].y + rects[i].h > h)
+            h = rects[i].y + rects[i].h;
+    }
+    return h;
+}
@@ -0,0 +1,29 @@
+/* tray_atlas.h
+ * Shelf packer for menu icon atlases – portable C99, no Win32 dependency
+ */
+#ifndef TRAY_ATLAS_H
+#define TRAY_ATLAS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tray_atlas_rect {
+    int w, h;        /* in:  cell size                                  */
+    int x, y;        /* out: position inside its page                   */
+    int page;        /* out: page index, -1 if the cell does not fit    */
+} tray_atlas_rect;
+
+/* Packs `count` cells into pages of page_w x page_h, tallest cells first,
+ * left to right on shelves. Returns the number of pages used (0 when
+ * count is 0) or -1 on allocation failure. Cells larger than a page get
+ * page = -1 and are otherwise ignored. */
+int tray_atlas_pack(tray_atlas_rect *rects, int count, int page_w, int page_h);
+
+/* Height actually used on `page` (max y + h of its cells) */
+int tray_atlas_page_height(const tray_atlas_rect *rects, int count, int page);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* TRAY_ATLAS_H */
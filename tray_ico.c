@@ -0,0 +1,640 @@
+/* tray_ico.c - ICO/PNG decoding to premultiplied BGRA */
+#include <stdlib.h>
+#include <string.h>
+#include "tray_ico.h"
+
+/* Every read is bounds-checked against the input: files come from disk and
+   may be truncated or hostile. */
+
+static unsigned int rd16(const unsigned char *p) { return (unsigned int)p[0] | ((unsigned int)p[1] << 8); }
+static unsigned int rd32(const unsigned char *p) { return rd16(p) | (rd16(p + 2) << 16); }
+static unsigned int rd32be(const unsigned char *p)
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+           ((unsigned int)p[2] << 8)  |  (unsigned int)p[3];
+}
+
+static const unsigned char png_sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+static int is_png(const unsigned char *p, size_t len)
+{
+    return len >= 8 && memcmp(p, png_sig, 8) == 0;
+}
+
+/* Straight RGBA → premultiplied BGRA */
+static unsigned int premul(unsigned int r, unsigned int g, unsigned int b, unsigned int a)
+{
+    if (a != 255) {
+        r = (r * a + 127) / 255;
+        g = (g * a + 127) / 255;
+        b = (b * a + 127) / 255;
+    }
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Inflate (RFC 1951), canonical Huffman decoding after zlib's puff.c        */
+/*  with a lookup table for codes of up to ZFAST_BITS bits                   */
+/* -------------------------------------------------------------------------- */
+#define ZFAST_BITS 9
+
+typedef struct {
+    const unsigned char *in;
+    size_t               in_len, in_pos;
+    unsigned long        bitbuf;
+    int                  bitcnt;
+    unsigned char       *out;
+    size_t               out_len, out_pos;
+} zstate;
+
+typedef struct {
+    short count[16];                  /* codes per length                 */
+    short symbol[288];                /* symbols ordered by code          */
+    unsigned short fast[1 << ZFAST_BITS]; /* by next bits: len << 9 | sym,
+                                             0 = longer code          */
+} zhuff;
+
+/* `need` bits (<= 13), -1 at end of input */
+static int zbits(zstate *s, int need)
+{
+    unsigned long val = s->bitbuf;
+    while (s->bitcnt < need) {
+        if (s->in_pos >= s->in_len) return -1;
+        val |= (unsigned long)s->in[s->in_pos++] << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    s->bitbuf  = val >> need;
+    s->bitcnt -= need;
+    return (int)(val & ((1UL << need) - 1));
+}
+
+/* 0 = complete code, > 0 = incomplete, < 0 = over-subscribed */
+static int zbuild(zhuff *h, const short *length, int n)
+{
+    short offs[16];
+    for (int len = 0; len < 16; len++) h->count[len] = 0;
+    for (int sym = 0; sym < n; sym++) h->count[length[sym]]++;
+    if (h->count[0] == n) return 0;
+
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) return left;
+    }
+    offs[1] = 0;
+    for (int len = 1; len < 15; len++) offs[len + 1] = (short)(offs[len] + h->count[len]);
+    for (int sym = 0; sym < n; sym++) {
+        if (length[sym]) h->symbol[offs[length[sym]]++] = (short)sym;
+    }
+
+    /* Codes arrive LSB first, so short codes fill every slot whose low
+       `len` bits are the code bit-reversed */
+    memset(h->fast, 0, sizeof(h->fast));
+    int code = 0, index = 0;
+    for (int len = 1; len <= ZFAST_BITS; len++) {
+        for (int i = 0; i < h->count[len]; i++, code++, index++) {
+            int rev = 0;
+            for (int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+            for (int slot = rev; slot < (1 << ZFAST_BITS); slot += 1 << len)
+                h->fast[slot] = (unsigned short)(len << 9 | h->symbol[index]);
+        }
+        code <<= 1;
+    }
+    return left;
+}
+
+static int zdecode(zstate *s, const zhuff *h)
+{
+    while (s->bitcnt <= 24 && s->in_pos < s->in_len) {
+        s->bitbuf |= (unsigned long)s->in[s->in_pos++] << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    unsigned int entry = h->fast[s->bitbuf & ((1u << ZFAST_BITS) - 1)];
+    if (entry && (int)(entry >> 9) <= s->bitcnt) {
+        s->bitbuf >>= entry >> 9;
+        s->bitcnt  -= (int)(entry >> 9);
+        return (int)(entry & 0x1FF);
+    }
+
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        int b = zbits(s, 1);
+        if (b < 0) return -1;
+        code |= b;
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code  <<= 1;
+    }
+    return -1;
+}
+
+static const short zlbase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const short zlext[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const short zdbase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const short zdext[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static int zcodes(zstate *s, const zhuff *lencode, const zhuff *distcode)
+{
+    for (;;) {
+        int sym = zdecode(s, lencode);
+        if (sym < 0) return -1;
+        if (sym < 256) {
+            if (s->out_pos >= s->out_len) return -1;
+            s->out[s->out_pos++] = (unsigned char)sym;
+        } else if (sym == 256) {
+            return 0;
+        } else {
+            sym -= 257;
+            if (sym >= 29) return -1;
+            int e = zbits(s, zlext[sym]);
+            if (e < 0) return -1;
+            size_t len = (size_t)(zlbase[sym] + e);
+
+            int dsym = zdecode(s, distcode);
+            if (dsym < 0 || dsym >= 30) return -1;
+            e = zbits(s, zdext[dsym]);
+            if (e < 0) return -1;
+            size_t dist = (size_t)(zdbase[dsym] + e);
+
+            if (dist > s->out_pos || s->out_len - s->out_pos < len) return -1;
+            unsigned char *o = s->out + s->out_pos;
+            for (size_t i = 0; i < len; i++) o[i] = o[(ptrdiff_t)i - (ptrdiff_t)dist];
+            s->out_pos += len;
+        }
+    }
+}
+
+static int zstored(zstate *s)
+{
+    s->in_pos -= (size_t)(s->bitcnt / 8);  /* return whole bytes the table */
+    s->bitbuf  = 0;                         /* decoder read ahead, then go  */
+    s->bitcnt  = 0;                         /* to the byte boundary         */
+    if (s->in_len - s->in_pos < 4) return -1;
+    unsigned int len  = rd16(s->in + s->in_pos);
+    unsigned int nlen = rd16(s->in + s->in_pos + 2);
+    s->in_pos += 4;
+    if (len != (~nlen & 0xFFFF)) return -1;
+    if (s->in_len - s->in_pos < len || s->out_len - s->out_pos < len) return -1;
+    memcpy(s->out + s->out_pos, s->in + s->in_pos, len);
+    s->in_pos  += len;
+    s->out_pos += len;
+    return 0;
+}
+
+static int zfixed(zstate *s)
+{
+    zhuff lencode, distcode;
+    short lengths[288];
+    int sym = 0;
+    for (; sym < 144; sym++) lengths[sym] = 8;
+    for (; sym < 256; sym++) lengths[sym] = 9;
+    for (; sym < 280; sym++) lengths[sym] = 7;
+    for (; sym < 288; sym++) lengths[sym] = 8;
+    zbuild(&lencode, lengths, 288);
+    for (sym = 0; sym < 30; sym++) lengths[sym] = 5;
+    zbuild(&distcode, lengths, 30);
+    return zcodes(s, &lencode, &distcode);
+}
+
+static int zdynamic(zstate *s)
+{
+    static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    short lengths[320];
+    zhuff lencode, distcode;
+
+    int nlen  = zbits(s, 5);
+    int ndist = zbits(s, 5);
+    int ncode = zbits(s, 4);
+    if (nlen < 0 || ndist < 0 || ncode < 0) return -1;
+    nlen += 257; ndist += 1; ncode += 4;
+    if (nlen > 286 || ndist > 30) return -1;
+
+    int index;
+    for (index = 0; index < ncode; index++) {
+        int b = zbits(s, 3);
+        if (b < 0) return -1;
+        lengths[order[index]] = (short)b;
+    }
+    for (; index < 19; index++) lengths[order[index]] = 0;
+    if (zbuild(&lencode, lengths, 19) != 0) return -1;
+
+    index = 0;
+    while (index < nlen + ndist) {
+        int sym = zdecode(s, &lencode);
+        if (sym < 0) return -1;
+        if (sym < 16) {
+            lengths[index++] = (short)sym;
+            continue;
+        }
+        short len = 0;
+        int   rep;
+        if (sym == 16) {
+            if (index == 0) return -1;
+            len = lengths[index - 1];
+            rep = zbits(s, 2);
+            if (rep < 0) return -1;
+            rep += 3;
+        } else if (sym == 17) {
+            rep = zbits(s, 3);
+            if (rep < 0) return -1;
+            rep += 3;
+        } else {
+            rep = zbits(s, 7);
+            if (rep < 0) return -1;
+            rep += 11;
+        }
+        if (index + rep > nlen + ndist) return -1;
+        while (rep--) lengths[index++] = len;
+    }
+    if (lengths[256] == 0) return -1;
+
+    /* Incomplete codes are only allowed for a single length/distance code */
+    int err = zbuild(&lencode, lengths, nlen);
+    if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1)) return -1;
+    err = zbuild(&distcode, lengths + nlen, ndist);
+    if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1)) return -1;
+
+    return zcodes(s, &lencode, &distcode);
+}
+
+/* zlib stream (RFC 1950) into out; returns bytes produced or -1 */
+static long zinflate(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_len)
+{
+    if (in_len < 2) return -1;
+    if ((in[0] & 0x0F) != 8 || (in[1] & 0x20) || ((in[0] << 8) | in[1]) % 31) return -1;
+
+    zstate s;
+    memset(&s, 0, sizeof(s));
+    s.in      = in + 2;
+    s.in_len  = in_len - 2;
+    s.out     = out;
+    s.out_len = out_len;
+
+    int last;
+    do {
+        last = zbits(&s, 1);
+        int type = zbits(&s, 2);
+        if (last < 0 || type < 0) return -1;
+        int err = type == 0 ? zstored(&s)
+                : type == 1 ? zfixed(&s)
+                : type == 2 ? zdynamic(&s)
+                : -1;
+        if (err) return -1;
+    } while (!last);
+    return (long)s.out_pos;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  PNG                                                                       */
+/* -------------------------------------------------------------------------- */
+static int paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+/* Reverses the per-row filters in place; rows are 1 + rowlen bytes. The
+   first row sees an all-zero row above it. */
+static int png_unfilter(unsigned char *raw, int h, size_t rowlen, int bpp)
+{
+    const unsigned char *prev = NULL;
+    for (int y = 0; y < h; y++) {
+        unsigned char *row = raw + (size_t)y * (rowlen + 1);
+        unsigned char *p = row + 1;
+        size_t i;
+        int filter = row[0];
+        if (!prev && filter == 4) filter = 1;   /* paeth(a, 0, 0) == a */
+        switch (filter) {
+        case 0:
+            break;
+        case 1:
+            for (i = (size_t)bpp; i < rowlen; i++) p[i] = (unsigned char)(p[i] + p[i - bpp]);
+            break;
+        case 2:
+            if (prev) for (i = 0; i < rowlen; i++) p[i] = (unsigned char)(p[i] + prev[i]);
+            break;
+        case 3:
+            for (i = 0; i < rowlen; i++) {
+                int a = i >= (size_t)bpp ? p[i - bpp] : 0;
+                int b = prev ? prev[i] : 0;
+                p[i] = (unsigned char)(p[i] + ((a + b) >> 1));
+            }
+            break;
+        case 4:
+            for (i = 0; i < (size_t)bpp && i < rowlen; i++) p[i] = (unsigned char)(p[i] + prev[i]);
+            for (; i < rowlen; i++)
+                p[i] = (unsigned char)(p[i] + paeth(p[i - bpp], prev[i], prev[i - bpp]));
+            break;
+        default:
+            return -1;
+        }
+        prev = p;
+    }
+    return 0;
+}
+
+/* Decodes a PNG into a malloc'd w x h premultiplied BGRA image */
+static unsigned int *png_decode(const unsigned char *data, size_t len, int *out_w, int *out_h)
+{
+    if (!is_png(data, len)) return NULL;
+
+    unsigned int w = 0, h = 0;
+    int depth = 0, ctype = -1, interlace = 0;
+    unsigned char palette[256 * 4];
+    unsigned int  palette_n = 0;
+    int key[3] = { -1, -1, -1 };       /* tRNS colour key of types 0 and 2 */
+    unsigned char *idat = NULL;
+    size_t idat_len = 0, idat_cap = 0;
+    unsigned int *img = NULL;
+    unsigned char *raw = NULL;
+
+    memset(palette, 255, sizeof(palette));
+    size_t pos = 8;
+    for (;;) {
+        if (len - pos < 12) goto fail;
+        size_t clen = rd32be(data + pos);
+        const unsigned char *type = data + pos + 4;
+        const unsigned char *cdata = data + pos + 8;
+        if (clen > len - pos - 12) goto fail;
+
+        if (!memcmp(type, "IHDR", 4)) {
+            if (clen < 13) goto fail;
+            w = rd32be(cdata);
+            h = rd32be(cdata + 4);
+            depth     = cdata[8];
+            ctype     = cdata[9];
+            interlace = cdata[12];
+        } else if (!memcmp(type, "PLTE", 4)) {
+            palette_n = (unsigned int)(clen / 3);
+            if (palette_n > 256) goto fail;
+            for (unsigned int i = 0; i < palette_n; i++) {
+                palette[i * 4 + 0] = cdata[i * 3 + 0];
+                palette[i * 4 + 1] = cdata[i * 3 + 1];
+                palette[i * 4 + 2] = cdata[i * 3 + 2];
+            }
+        } else if (!memcmp(type, "tRNS", 4)) {
+            /* Palette alpha, or one 16-bit sample per channel: pixels equal
+               to that colour are transparent; above 255 it matches none */
+            if (ctype == 3) {
+                for (size_t i = 0; i < clen && i < 256; i++) palette[i * 4 + 3] = cdata[i];
+            } else if ((ctype == 0 && clen >= 2) || (ctype == 2 && clen >= 6)) {
+                for (int c = 0; c < (ctype == 0 ? 1 : 3); c++)
+                    key[c] = (cdata[c * 2] << 8) | cdata[c * 2 + 1];
+            }
+        } else if (!memcmp(type, "IDAT", 4) && clen) {
+            if (idat_len + clen > idat_cap) {
+                size_t cap = idat_cap ? idat_cap * 2 : 4096;
+                while (cap < idat_len + clen) cap *= 2;
+                unsigned char *grown = (unsigned char *)realloc(idat, cap);
+                if (!grown) goto fail;
+                idat = grown;
+                idat_cap = cap;
+            }
+            memcpy(idat + idat_len, cdata, clen);
+            idat_len += clen;
+        } else if (!memcmp(type, "IEND", 4)) {
+            break;
+        }
+        pos += clen + 12;
+    }
+
+    static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    if (w == 0 || h == 0 || w > TRAY_ICO_MAX_SIDE || h > TRAY_ICO_MAX_SIDE) goto fail;
+    if (depth != 8 || ctype < 0 || ctype > 6 || !channels[ctype] || interlace) goto fail;
+    if (ctype == 3 && !palette_n) goto fail;
+
+    int    bpp    = channels[ctype];
+    size_t rowlen = (size_t)w * (size_t)bpp;
+    size_t rawlen = (rowlen + 1) * h;
+    raw = (unsigned char *)malloc(rawlen);
+    img = (unsigned int *)malloc((size_t)w * h * sizeof(*img));
+    if (!raw || !img || !idat) goto fail;
+    if (zinflate(idat, idat_len, raw, rawlen) != (long)rawlen) goto fail;
+    if (png_unfilter(raw, (int)h, rowlen, bpp)) goto fail;
+
+    for (unsigned int y = 0; y < h; y++) {
+        const unsigned char *p = raw + (size_t)y * (rowlen + 1) + 1;
+        unsigned int *o = img + (size_t)y * w;
+        for (unsigned int x = 0; x < w; x++, p += bpp) {
+            switch (ctype) {
+            case 0: o[x] = p[0] == key[0] ? 0 : premul(p[0], p[0], p[0], 255); break;
+            case 2:
+                o[x] = p[0] == key[0] && p[1] == key[1] && p[2] == key[2]
+                     ? 0 : premul(p[0], p[1], p[2], 255);
+                break;
+            case 3: {
+                const unsigned char *c = palette + p[0] * 4;
+                o[x] = p[0] < palette_n ? premul(c[0], c[1], c[2], c[3]) : 0;
+                break;
+            }
+            case 4: o[x] = premul(p[0], p[0], p[0], p[1]); break;
+            default: o[x] = premul(p[0], p[1], p[2], p[3]); break;
+            }
+        }
+    }
+
+    free(raw);
+    free(idat);
+    *out_w = (int)w;
+    *out_h = (int)h;
+    return img;
+
+fail:
+    free(raw);
+    free(img);
+    free(idat);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  BMP entries (BITMAPINFOHEADER + XOR image + AND mask, bottom-up)          */
+/* -------------------------------------------------------------------------- */
+static unsigned int *bmp_decode(const unsigned char *data, size_t len, int *out_w, int *out_h)
+{
+    if (len < 40) return NULL;
+    unsigned int hdr = rd32(data);
+    int w   = (int)rd32(data + 4);
+    int h2  = (int)rd32(data + 8);              /* XOR + AND: twice the height */
+    int bpp = (int)rd16(data + 14);
+    unsigned int compression = rd32(data + 16);
+    unsigned int colors      = rd32(data + 32);
+    if (hdr < 40 || hdr > len || compression != 0) return NULL;
+    if (w <= 0 || w > TRAY_ICO_MAX_SIDE || h2 <= 0 || h2 > 2 * TRAY_ICO_MAX_SIDE) return NULL;
+    if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32) return NULL;
+    int h = h2 / 2;
+    if (h <= 0) return NULL;
+
+    size_t pal_n = 0;
+    if (bpp <= 8) {
+        pal_n = colors ? colors : (1u << bpp);
+        if (pal_n > 256) return NULL;
+    }
+    size_t xor_stride = (((size_t)w * bpp + 31) / 32) * 4;
+    size_t and_stride = (((size_t)w + 31) / 32) * 4;
+    size_t pal_off = hdr, xor_off = pal_off + pal_n * 4, and_off = xor_off + xor_stride * h;
+    if (xor_off > len || len - xor_off < xor_stride * h) return NULL;
+    /* The AND mask is optional for 32 bpp images with real alpha */
+    int has_and = and_off <= len && len - and_off >= and_stride * h;
+    if (!has_and && bpp != 32) return NULL;
+
+    unsigned int *img = (unsigned int *)malloc((size_t)w * h * sizeof(*img));
+    if (!img) return NULL;
+
+    const unsigned char *pal = data + pal_off;
+    int any_alpha = 0;
+    for (int y = 0; y < h; y++) {
+        const unsigned char *row = data + xor_off + (size_t)(h - 1 - y) * xor_stride;
+        unsigned int *o = img + (size_t)y * w;
+        for (int x = 0; x < w; x++) {
+            unsigned int b, g, r, a = 255;
+            if (bpp == 32) {
+                b = row[x * 4]; g = row[x * 4 + 1]; r = row[x * 4 + 2]; a = row[x * 4 + 3];
+                if (a) any_alpha = 1;
+            } else if (bpp == 24) {
+                b = row[x * 3]; g = row[x * 3 + 1]; r = row[x * 3 + 2];
+            } else {
+                unsigned int idx;
+                if (bpp == 8)      idx = row[x];
+                else if (bpp == 4) idx = (row[x / 2] >> (x & 1 ? 0 : 4)) & 0x0F;
+                else               idx = (row[x / 8] >> (7 - (x & 7))) & 0x01;
+                if (idx >= pal_n) idx = 0;
+                b = pal[idx * 4]; g = pal[idx * 4 + 1]; r = pal[idx * 4 + 2];
+            }
+            /* Straight values for now; alpha settled below */
+            o[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    /* Without real alpha the AND mask decides: set bit = transparent */
+    int use_mask = has_and && (bpp != 32 || !any_alpha);
+    for (int y = 0; y < h; y++) {
+        const unsigned char *mask = use_mask ? data + and_off + (size_t)(h - 1 - y) * and_stride : NULL;
+        unsigned int *o = img + (size_t)y * w;
+        for (int x = 0; x < w; x++) {
+            unsigned int p = o[x];
+            unsigned int a = p >> 24;
+            if (use_mask) a = (mask[x / 8] >> (7 - (x & 7))) & 1 ? 0 : 255;
+            o[x] = premul((p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF, a);
+        }
+    }
+
+    *out_w = w;
+    *out_h = h;
+    return img;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  ICO directory                                                             */
+/* -------------------------------------------------------------------------- */
+static int ico_count(const unsigned char *data, size_t len)
+{
+    if (len < 6 || rd16(data) != 0 || (rd16(data + 2) != 1 && rd16(data + 2) != 2)) return -1;
+    int count = (int)rd16(data + 4);
+    if (count == 0 || len - 6 < (size_t)count * 16) return -1;
+    return count;
+}
+
+int tray_ico_select(const unsigned char *data, size_t len, int size_px, int dpi)
+{
+    int count = ico_count(data, len);
+    if (count < 0) return -1;
+    int target = dpi > 0 ? (size_px * dpi + 48) / 96 : size_px;
+
+    int best = -1, best_side = 0, best_bpp = 0;
+    for (int i = 0; i < count; i++) {
+        const unsigned char *e = data + 6 + (size_t)i * 16;
+        unsigned int size = rd32(e + 8), offset = rd32(e + 12);
+        if (offset > len || size > len - offset || size == 0) continue;
+        int w = e[0] ? e[0] : 256, h = e[1] ? e[1] : 256;
+        int side = w > h ? w : h;
+        int bpp  = (int)rd16(e + 6);
+        if (!bpp || is_png(data + offset, size)) bpp = 32;   /* often 0 in the directory */
+
+        int better;
+        if (best < 0)                                      better = 1;
+        else if (side == best_side)                        better = bpp > best_bpp;
+        else if (best_side >= target && side >= target)    better = side < best_side;
+        else                                               better = side > best_side;
+        if (better) {
+            best = i;
+            best_side = side;
+            best_bpp  = bpp;
+        }
+    }
+    return best;
+}
+
+/* Box filter (nearest when enlarging) of premultiplied pixels */
+static void scale_into(const unsigned int *src, int sw, int sh,
+                       unsigned int *out, int dw, int dh, int stride)
+{
+    if (sw == dw && sh == dh) {
+        for (int y = 0; y < dh; y++)
+            memcpy((unsigned char *)out + (size_t)y * stride, src + (size_t)y * sw, (size_t)dw * 4);
+        return;
+    }
+    for (int y = 0; y < dh; y++) {
+        int y0 = (int)((long long)y * sh / dh), y1 = (int)((long long)(y + 1) * sh / dh);
+        if (y1 <= y0) y1 = y0 + 1;
+        unsigned int *o = (unsigned int *)((unsigned char *)out + (size_t)y * stride);
+        for (int x = 0; x < dw; x++) {
+            int x0 = (int)((long long)x * sw / dw), x1 = (int)((long long)(x + 1) * sw / dw);
+            if (x1 <= x0) x1 = x0 + 1;
+            if (x1 - x0 == 1 && y1 - y0 == 1) {
+                o[x] = src[(size_t)y0 * sw + x0];
+                continue;
+            }
+            unsigned int sum[4] = { 0, 0, 0, 0 }, n = 0;
+            for (int sy = y0; sy < y1; sy++) {
+                for (int sx = x0; sx < x1; sx++) {
+                    unsigned int p = src[(size_t)sy * sw + sx];
+                    sum[0] += p & 0xFF;
+                    sum[1] += (p >> 8) & 0xFF;
+                    sum[2] += (p >> 16) & 0xFF;
+                    sum[3] += p >> 24;
+                    n++;
+                }
+            }
+            o[x] = ((sum[3] + n / 2) / n << 24) | ((sum[2] + n / 2) / n << 16) |
+                   ((sum[1] + n / 2) / n << 8)  |  (sum[0] + n / 2) / n;
+        }
+    }
+}
+
+int tray_ico_decode(const unsigned char *data, size_t len,
+                    unsigned int *out, int out_w, int out_h, int stride)
+{
+    if (!data || !out || out_w <= 0 || out_h <= 0 || stride < out_w * 4) return -1;
+
+    const unsigned char *img_data = data;
+    size_t img_len = len;
+    if (!is_png(data, len)) {
+        int i = tray_ico_select(data, len, out_w > out_h ? out_w : out_h, 96);
+        if (i < 0) return -1;
+        const unsigned char *e = data + 6 + (size_t)i * 16;
+        img_data = data + rd32(e + 12);
+        img_len  = rd32(e + 8);
+    }
+
+    int w = 0, h = 0;
+    unsigned int *img = is_png(img_data, img_len) ? png_decode(img_data, img_len, &w, &h)
+                                                  : bmp_decode(img_data, img_len, &w, &h);
+    if (!img) return -1;
+    scale_into(img, w, h, out, out_w, out_h, stride);
+    free(img);
+    return 0;
+}
@@ -0,0 +1,35 @@
+/* tray_ico.h
+ * ICO container and PNG decoding for tray and menu icons – portable C99,
+ * no Win32 dependency. Works on a file image in memory (a mapped view) and
+ * decodes a single entry to premultiplied BGRA.
+ */
+#ifndef TRAY_ICO_H
+#define TRAY_ICO_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRAY_ICO_MAX_SIDE 1024      /* larger images are rejected         */
+
+/* Index of the ICO directory entry that best fits an icon of size_px
+ * logical pixels at dpi (96 = 100 %): the smallest image at least that
+ * large, else the largest one; equal sizes prefer more bits per pixel.
+ * Returns -1 if data is not a well-formed ICO. */
+int tray_ico_select(const unsigned char *data, size_t len, int size_px, int dpi);
+
+/* Decodes an ICO file (best entry for out_w device pixels) or a bare PNG
+ * into out_w x out_h premultiplied BGRA, top-down, `stride` bytes per row.
+ * The chosen image is box-filtered when its size differs. Supports BMP
+ * entries of 1/4/8/24/32 bpp with AND mask and 8-bit PNG of every colour
+ * type, non-interlaced, with tRNS palette alpha or colour key. Returns 0, or -1 for unsupported or malformed
+ * input, in which case `out` is left untouched. */
+int tray_ico_decode(const unsigned char *data, size_t len,
+                    unsigned int *out, int out_w, int out_h, int stride);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+#endif /* TRAY_ICO_H */
@@ -5,9 +5,12 @@
 #include <windows.h>
 #include <shellapi.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "tray.h"
+#include "tray_atlas.h"
+#include "tray_ico.h"
 
 /* -------------------------------------------------------------------------- */
 /*  Helpers: opt-in dark mode                                                 */
@@ -32,6 +35,17 @@ static void tray_enable_dark_mode(void)
         SetPreferredAppMode(AppMode_AllowDark);
 }
 
+/* Wrap in SEH: tray_enable_dark_mode uses undocumented ordinal 135 of
+   uxtheme.dll which may cause an access violation on some Windows 10 builds. */
+static void tray_enable_dark_mode_safe(void)
+{
+    __try {
+        tray_enable_dark_mode();
+    } __except(EXCEPTION_EXECUTE_HANDLER) {
+        /* Silently ignore – dark-mode theming is cosmetic only. */
+    }
+}
+
 /* -------------------------------------------------------------------------- */
 /*  UTF-8 to UTF-16 conversion helper                                         */
 /* -------------------------------------------------------------------------- */
@@ -66,12 +80,202 @@ static char* wide_to_utf8(const WCHAR *wide_str)
     return utf8_str;
 }
 
+/* -------------------------------------------------------------------------- */
+/*  Interned UTF-16 strings                                                   */
+/*  Labels, tooltips and icon paths repeat across updates: each distinct      */
+/*  UTF-8 string is converted once and shared by reference count. The table  */
+/*  holds one reference per entry and drops least recently used entries      */
+/*  past TRAY_WSTR_CACHE_BYTES; entries still in use live on until released. */
+/* -------------------------------------------------------------------------- */
+#define TRAY_WSTR_BUCKETS     1024              /* power of two            */
+#define TRAY_WSTR_CACHE_BYTES (256 * 1024)
+
+typedef struct WStr {
+    volatile LONG refs;               /* table's + one per user           */
+    UINT          hash;
+    UINT          len;                /* key bytes, without NUL           */
+    UINT          wlen;               /* characters in wide, without NUL  */
+    UINT          size;               /* allocation size, counted to the bound */
+    struct WStr  *chain;              /* bucket list                      */
+    struct WStr  *prev, *next;        /* LRU list, most recent first      */
+    WCHAR        *wide;               /* points into this allocation      */
+    char          key[];              /* UTF-8, NUL terminated            */
+} WStr;
+
+static CRITICAL_SECTION wstr_cs;
+static INIT_ONCE        wstr_once        = INIT_ONCE_STATIC_INIT;
+static WStr            *wstr_buckets[TRAY_WSTR_BUCKETS];
+static WStr            *wstr_lru_head    = NULL;
+static WStr            *wstr_lru_tail    = NULL;
+static struct tray_string_stats wstr_stats;
+
+static BOOL CALLBACK wstr_init_once(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once; (void)param; (void)ctx;
+    InitializeCriticalSection(&wstr_cs);
+    return TRUE;
+}
+
+/* Pool workers intern paths too, so the first call can come from any thread.
+   wstr_cs lives until process exit; wstr_clear only empties the table. */
+static void wstr_init(void)
+{
+    InitOnceExecuteOnce(&wstr_once, wstr_init_once, NULL, NULL);
+}
+
+/* FNV-1a */
+static UINT wstr_hash(const char *s, size_t len)
+{
+    UINT h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void wstr_release(WStr *w)
+{
+    if (w && InterlockedDecrement(&w->refs) == 0) free(w);
+}
+
+/* LRU list maintenance; caller holds wstr_cs */
+static void wstr_unlink(WStr *w)
+{
+    if (w->prev) w->prev->next = w->next; else wstr_lru_head = w->next;
+    if (w->next) w->next->prev = w->prev; else wstr_lru_tail = w->prev;
+    w->prev = w->next = NULL;
+}
+
+static void wstr_push_front(WStr *w)
+{
+    w->prev = NULL;
+    w->next = wstr_lru_head;
+    if (wstr_lru_head) wstr_lru_head->prev = w;
+    else               wstr_lru_tail = w;
+    wstr_lru_head = w;
+}
+
+/* Caller holds wstr_cs */
+static WStr *wstr_find(const char *utf8, size_t len, UINT h)
+{
+    for (WStr *w = wstr_buckets[h & (TRAY_WSTR_BUCKETS - 1)]; w; w = w->chain) {
+        if (w->hash == h && w->len == len && memcmp(w->key, utf8, len) == 0)
+            return w;
+    }
+    return NULL;
+}
+
+/* Removes an entry and drops the table's reference; caller holds wstr_cs */
+static void wstr_evict(WStr *w)
+{
+    WStr **pp = &wstr_buckets[w->hash & (TRAY_WSTR_BUCKETS - 1)];
+    while (*pp != w) pp = &(*pp)->chain;
+    *pp = w->chain;
+    wstr_unlink(w);
+    wstr_stats.entries--;
+    wstr_stats.bytes -= w->size;
+    wstr_release(w);
+}
+
+/* Shared UTF-16 copy of utf8 with one reference for the caller, to be
+   dropped with wstr_release. NULL for NULL/"" (like utf8_to_wide) or OOM.
+   A hit neither converts nor allocates. */
+static WStr *wstr_intern(const char *utf8)
+{
+    if (!utf8 || !*utf8) return NULL;
+    size_t len = strlen(utf8);
+    UINT   h   = wstr_hash(utf8, len);
+
+    wstr_init();
+    EnterCriticalSection(&wstr_cs);
+    WStr *w = wstr_find(utf8, len, h);
+    if (w) {
+        if (w != wstr_lru_head) {
+            wstr_unlink(w);
+            wstr_push_front(w);
+        }
+        InterlockedIncrement(&w->refs);
+        wstr_stats.hits++;
+        LeaveCriticalSection(&wstr_cs);
+        return w;
+    }
+    wstr_stats.misses++;
+    LeaveCriticalSection(&wstr_cs);
+
+    /* Miss: convert outside the lock, key and UTF-16 text in one block */
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, utf8, -1, NULL, 0);
+    if (wlen <= 0) return NULL;
+    size_t off  = (offsetof(WStr, key) + len + 1 + sizeof(WCHAR) - 1) & ~(sizeof(WCHAR) - 1);
+    size_t size = off + (size_t)wlen * sizeof(WCHAR);
+    w = (WStr *)calloc(1, size);
+    if (!w) return NULL;
+    w->hash = h;
+    w->len  = (UINT)len;
+    w->wlen = (UINT)wlen - 1;
+    w->size = (UINT)size;
+    w->wide = (WCHAR *)((char *)w + off);
+    memcpy(w->key, utf8, len + 1);
+    MultiByteToWideChar(CP_UTF8, 0, utf8, -1, w->wide, wlen);
+
+    /* Larger than the whole bound: handed out uncached */
+    if (size > TRAY_WSTR_CACHE_BYTES) {
+        w->refs = 1;
+        return w;
+    }
+
+    EnterCriticalSection(&wstr_cs);
+    WStr *raced = wstr_find(utf8, len, h);      /* another thread inserted it */
+    if (raced) {
+        InterlockedIncrement(&raced->refs);
+        LeaveCriticalSection(&wstr_cs);
+        free(w);
+        return raced;
+    }
+    w->refs  = 2;                                /* table + caller */
+    w->chain = wstr_buckets[h & (TRAY_WSTR_BUCKETS - 1)];
+    wstr_buckets[h & (TRAY_WSTR_BUCKETS - 1)] = w;
+    wstr_push_front(w);
+    wstr_stats.entries++;
+    wstr_stats.bytes += w->size;
+    while (wstr_stats.bytes > TRAY_WSTR_CACHE_BYTES && wstr_lru_tail != w) {
+        wstr_evict(wstr_lru_tail);
+        wstr_stats.evictions++;
+    }
+    LeaveCriticalSection(&wstr_cs);
+    return w;
+}
+
+/* Drops every entry (last tray gone); strings still in use stay valid */
+static void wstr_clear(void)
+{
+    wstr_init();
+    EnterCriticalSection(&wstr_cs);
+    while (wstr_lru_tail) wstr_evict(wstr_lru_tail);
+    LeaveCriticalSection(&wstr_cs);
+}
+
 /* -------------------------------------------------------------------------- */
 /*  Internal constants                                                        */
 /* -------------------------------------------------------------------------- */
 #define WM_TRAY_CALLBACK_MESSAGE (WM_USER + 1)
+#define WM_TRAY_ICONS_READY      (WM_USER + 2)   /* lParam = IconJob*       */
 #define WC_TRAY_CLASS_NAME       L"TRAY"
 #define ID_TRAY_FIRST            1000
+#define TRAY_MENU_ICON_SIZE      16      /* menu icon cell, in pixels       */
+#define TRAY_ATLAS_PAGE_SIZE     256     /* atlas page edge: 256 icons/page */
+#define TRAY_NOTIFY_ICON_SIZE    16      /* tray icon at 96 DPI, in pixels  */
+#define TRAY_ICON_FILE_MAX       (16 * 1024 * 1024)   /* larger: not mapped */
+
+/* Item handles pack a layout tag and the item's command index. Every
+   distinct menu layout a tray shows gets a new process-wide tag (1..65535,
+   wrapping), so a handle is rejected once items move instead of hitting
+   whatever now sits at its position. */
+#define TRAY_HANDLE_INDEX_BITS     15
+#define TRAY_HANDLE_MAX_ITEMS      (1u << TRAY_HANDLE_INDEX_BITS)
+#define TRAY_ITEM_HANDLE(tag, cmd) ((int)(((tag) << TRAY_HANDLE_INDEX_BITS) | ((cmd) - ID_TRAY_FIRST)))
+#define TRAY_HANDLE_TAG(h)         ((UINT)(h) >> TRAY_HANDLE_INDEX_BITS)
+#define TRAY_HANDLE_CMD(h)         (ID_TRAY_FIRST + ((UINT)(h) & (TRAY_HANDLE_MAX_ITEMS - 1)))
 
 /* -------------------------------------------------------------------------- */
 /*  Internal variables                                                        */
@@ -86,11 +290,88 @@ static BOOL             exit_called    = FALSE;  /* unused in multi-instance mod
 static CRITICAL_SECTION tray_cs;
 static BOOL             cs_initialized = FALSE;
 
+/* Decoded menu icons packed into a few 32-bit DIB pages, drawn by
+   owner-draw (HBMMENU_CALLBACK) instead of one HBITMAP each. Read-only
+   once built, and shared by every generation that draws from them. */
+typedef struct IconPages {
+    volatile LONG    refs;
+    HBITMAP         *pages;           /* premultiplied BGRA DIB sections  */
+    DWORD          **bits;            /* pixels of each page, top-down    */
+    int              page_count;
+} IconPages;
+
+/* Menu icons of one menu generation: its cells in the shared pages. The
+   next build looks paths up here to keep their pixels. */
+typedef struct IconAtlas {
+    IconPages       *pages;
+    tray_atlas_rect *cells;           /* command ID - ID_TRAY_FIRST → cell, w == 0: none */
+    WStr           **paths;           /* icon path of each drawn cell     */
+    UINT             cell_count;
+} IconAtlas;
+
+/* Background icon decoding: one job per menu build, owned by refcount.
+   The context holds one reference while the job is current, the worker
+   holds one until its WM_TRAY_ICONS_READY message has been handled or
+   destroy_ctx reclaims it from g_icon_posted. */
+typedef struct IconSlot {
+    UINT     cmd;                     /* menu command ID                  */
+    WStr    *path;                    /* icon path, interned reference    */
+    tray_atlas_rect from;             /* cell in job->src, w == 0: decode */
+} IconSlot;
+
+typedef struct IconJob {
+    volatile LONG refs;
+    volatile LONG cancelled;          /* set when a newer update supersedes */
+    HWND       hwnd;                  /* window that receives the result  */
+    IconSlot  *slots;
+    UINT       count;
+    UINT       capacity;              /* command IDs in the menu          */
+    IconPages *src;                   /* previous pages, copied from      */
+    IconAtlas *atlas;                 /* decoded menu icons               */
+    WStr      *tray_icon_path;        /* notification icon, NULL = none   */
+    HICON      tray_icon;
+    struct IconJob *posted_next;      /* on g_icon_posted                 */
+} IconJob;
+
+/* What a pick needs of an item, copied at build time: once tray_update
+   returns, the host may free the array an open popup was built from */
+typedef struct MenuSlot {
+    struct tray_menu_item *item;      /* passed to cb, never read         */
+    void (*cb)(struct tray_menu_item *);
+} MenuSlot;
+
+/* One built menu. The context points at the newest generation; a popup
+   runs on the generation it was opened with, without holding tray_cs, so
+   writers can replace ctx->menu meanwhile. A generation is freed once it
+   is neither current nor on screen. */
+typedef struct MenuGen {
+    HMENU        hmenu;               /* root menu                        */
+    MenuSlot    *items;               /* command ID - ID_TRAY_FIRST → item */
+    UINT         item_count;          /* number of slots in items         */
+    IconJob     *icon_job;            /* pending menu icon decode, if any */
+    IconAtlas   *atlas;               /* decoded menu icons               */
+    UINT         layout;              /* layout tag for item handles      */
+} MenuGen;
+
 /* Multi-instance support: one context per tray */
 typedef struct TrayContext {
     struct tray *tray;                /* public tray pointer (key)        */
     HWND         hwnd;                /* hidden window for messages       */
-    HMENU        hmenu;               /* root menu                        */
+    MenuGen     *menu;                /* current menu generation          */
+    MenuGen     *open_menu;           /* generation of the open popup     */
+    unsigned char *shape;             /* layout of the current menu, see  */
+    UINT         shape_len;           /*   tray_menu_shape                */
+    UINT         layout;              /* its tag                          */
+    IconJob     *notify_job;          /* pending tray icon decode, if any */
+    WStr        *icon_path;           /* path of the shown or pending icon */
+    BOOL         menu_dirty;          /* menu is stale, rebuild before use */
+    BOOL         startup_pending;     /* fast start: dark mode + menu deferred */
+    LARGE_INTEGER init_start;         /* tray_init entry, for timings     */
+    struct tray_startup_timings timings;
+    BOOL         popup_pending;       /* click seen, popup not shown yet  */
+    LARGE_INTEGER click_time;         /* when the pending click arrived   */
+    double       latency_sum_ms;
+    struct tray_menu_latency latency;
     NOTIFYICONDATAW nid;              /* per-icon notify data             */
     UINT         uID;                 /* unique id for Shell_NotifyIcon   */
     DWORD        threadId;            /* thread that owns this context    */
@@ -100,6 +381,24 @@ typedef struct TrayContext {
 
 static TrayContext *g_ctx_head = NULL;
 static UINT g_next_uid = ID_TRAY_FIRST;
+static UINT g_next_layout = 1;            /* item handle tags, never 0 */
+static UINT g_ctx_pinned  = 0;            /* destroyed while their popup ran */
+
+/* Polled event mode: bounded lock-free MPMC ring (one sequence number per
+   cell). Window procedures of any tray thread produce, the host drains. */
+#define TRAY_EVENT_QUEUE_SIZE 1024        /* power of two */
+
+typedef struct EventCell {
+    volatile LONG     seq;
+    struct tray_event ev;
+} EventCell;
+
+static EventCell     g_events[TRAY_EVENT_QUEUE_SIZE];
+static volatile LONG g_event_head     = 0;   /* next position to write */
+static volatile LONG g_event_tail     = 0;   /* next position to read  */
+static volatile LONG g_events_dropped = 0;
+static volatile LONG g_event_mode     = 0;   /* 1 = queue instead of cb */
+static volatile LONG g_events_ready   = 0;
 
 static void ensure_critical_section(void);
 static TrayContext* find_ctx_by_tray(struct tray *t);
@@ -112,9 +411,230 @@ static void destroy_ctx(TrayContext *ctx);
 /* -------------------------------------------------------------------------- */
 /*  Internal prototypes                                                       */
 /* -------------------------------------------------------------------------- */
-static HMENU tray_menu_item(struct tray_menu_item *m, UINT *id);
+static HMENU tray_menu_item(struct tray_menu_item *m, UINT *id,
+                            MenuSlot *items, IconJob *job);
+static UINT tray_menu_count(struct tray_menu_item *m);
+static void tray_menu_destroy(HMENU menu);
+static void menu_gen_free(MenuGen *gen);
+static void icon_job_release(IconJob *job);
+static void icon_job_cancel(IconJob **slot);
+static void icon_job_reclaim(HWND h);
+static void tray_build_menu(TrayContext *ctx);
+static void tray_set_tooltip(TrayContext *ctx, struct tray *tray);
+static void tray_finish_startup(TrayContext *ctx);
+static double elapsed_ms(LARGE_INTEGER since);
+static void tray_prepare_menu(TrayContext *ctx);
+static void tray_record_latency(TrayContext *ctx);
 static void ensure_critical_section(void);
-static HBITMAP load_icon_bitmap(const char *icon_path);
+static BOOL draw_icon_file(HDC dc, int x, int y, int cx, int cy, const WStr *path);
+static void icon_atlas_free(IconAtlas *atlas);
+static void tray_lock(void);
+
+/* -------------------------------------------------------------------------- */
+/*  Timeline tracing                                                          */
+/*  Spans are appended to a buffer owned by the recording thread (no lock);   */
+/*  trace_cs only guards buffer registration and writing out. A full buffer  */
+/*  is replaced by a fresh one and kept: spans often close under tray_cs, so */
+/*  nothing is written until tray_trace_stop, which writes and frees every   */
+/*  buffer and the TLS index; pool threads that came and went leave nothing. */
+/* -------------------------------------------------------------------------- */
+#define TRAY_TRACE_BUF_EVENTS 1024
+
+typedef struct TraceEvent {
+    const char *name;                 /* static strings                   */
+    const char *cat;
+    LONGLONG    start, dur;           /* QueryPerformanceCounter ticks    */
+    char        arg[48];              /* optional detail, "" = none       */
+} TraceEvent;
+
+typedef struct TraceBuf {
+    DWORD            tid;
+    volatile LONG    head;            /* next slot, written by the owner  */
+    struct TraceBuf *next;            /* registration order               */
+    TraceEvent       ev[TRAY_TRACE_BUF_EVENTS];
+} TraceBuf;
+
+static volatile LONG    g_trace_on  = 0;
+static volatile LONG    g_trace_busy = 0;         /* threads inside trace_end */
+static DWORD            g_trace_tls = TLS_OUT_OF_INDEXES;
+static CRITICAL_SECTION trace_cs;                 /* valid while g_trace_tls is */
+static TraceBuf        *g_trace_bufs  = NULL;
+static TraceBuf       **g_trace_last  = &g_trace_bufs;
+static FILE            *g_trace_file  = NULL;
+static tray_trace_sink  g_trace_sink  = NULL;
+static void            *g_trace_user  = NULL;
+static BOOL             g_trace_first = TRUE;
+static double           g_trace_ns_per_tick;
+static DWORD            g_trace_pid;
+
+/* Span start, 0 while tracing is off */
+static LONGLONG trace_begin(void)
+{
+    if (!g_trace_on) return 0;
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+/* Caller holds trace_cs */
+static void trace_write(const char *s, size_t n)
+{
+    if (g_trace_file)      fwrite(s, 1, n, g_trace_file);
+    else if (g_trace_sink) g_trace_sink(s, (unsigned int)n, g_trace_user);
+}
+
+static char *trace_put(char *o, const char *s)
+{
+    while (*s) *o++ = *s++;
+    return o;
+}
+
+/* Decimal, at least `digits` digits (zero padded) */
+static char *trace_put_uint(char *o, unsigned long long v, int digits)
+{
+    char tmp[24];
+    int  n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v || n < digits);
+    while (n) *o++ = tmp[--n];
+    return o;
+}
+
+/* Ticks as microseconds with three decimals */
+static char *trace_put_us(char *o, LONGLONG ticks)
+{
+    unsigned long long ns = (unsigned long long)((double)ticks * g_trace_ns_per_tick);
+    o = trace_put_uint(o, ns / 1000, 1);
+    *o++ = '.';
+    return trace_put_uint(o, ns % 1000, 3);
+}
+
+/* Writes the buffer's events; caller holds trace_cs. Formatted by hand:
+   snprintf dominated the cost of a traced span. */
+static void trace_flush_buf(TraceBuf *b)
+{
+    LONG head = b->head;
+    char line[512];                   /* fits the longest event, escaped */
+
+    for (LONG i = 0; i < head; i++) {
+        const TraceEvent *e = &b->ev[i];
+        char *o = line;
+        o = trace_put(o, g_trace_first ? "{\"name\":\"" : ",\n{\"name\":\"");
+        o = trace_put(o, e->name);
+        o = trace_put(o, "\",\"cat\":\"");
+        o = trace_put(o, e->cat);
+        o = trace_put(o, "\",\"ph\":\"X\",\"pid\":");
+        o = trace_put_uint(o, g_trace_pid, 1);
+        o = trace_put(o, ",\"tid\":");
+        o = trace_put_uint(o, b->tid, 1);
+        o = trace_put(o, ",\"ts\":");
+        o = trace_put_us(o, e->start);
+        o = trace_put(o, ",\"dur\":");
+        o = trace_put_us(o, e->dur);
+        if (e->arg[0]) {
+            o = trace_put(o, ",\"args\":{\"detail\":\"");
+            for (const unsigned char *c = (const unsigned char *)e->arg; *c; c++) {
+                if (*c == '"' || *c == '\\') {
+                    *o++ = '\\';
+                    *o++ = (char)*c;
+                } else if (*c < 0x20) {
+                    o = trace_put(o, "\\u00");
+                    *o++ = "0123456789abcdef"[*c >> 4];
+                    *o++ = "0123456789abcdef"[*c & 15];
+                } else {
+                    *o++ = (char)*c;
+                }
+            }
+            o = trace_put(o, "\"}");
+        }
+        *o++ = '}';
+        trace_write(line, (size_t)(o - line));
+        g_trace_first = FALSE;
+    }
+}
+
+/* New buffer for the calling thread, registered after its earlier ones */
+static TraceBuf *trace_buf_new(void)
+{
+    TraceBuf *b = (TraceBuf *)calloc(1, sizeof(TraceBuf));
+    if (!b) return NULL;
+    b->tid = GetCurrentThreadId();
+    TlsSetValue(g_trace_tls, b);
+    EnterCriticalSection(&trace_cs);
+    *g_trace_last = b;
+    g_trace_last  = &b->next;
+    LeaveCriticalSection(&trace_cs);
+    return b;
+}
+
+/* Calling thread's buffer, registered on first use */
+static TraceBuf *trace_buf(void)
+{
+    TraceBuf *b = (TraceBuf *)TlsGetValue(g_trace_tls);
+    return b ? b : trace_buf_new();
+}
+
+/* Closes a span opened by trace_begin; arg (optional) keeps its tail */
+static void trace_end(LONGLONG start, const char *name, const char *cat, const char *arg)
+{
+    if (!start) return;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    /* Counted in before checking g_trace_on: tray_trace_stop waits for
+       spans already past the check before it frees their buffers */
+    InterlockedIncrement(&g_trace_busy);
+    TraceBuf *b = g_trace_on ? trace_buf() : NULL;
+    if (b && b->head == TRAY_TRACE_BUF_EVENTS) b = trace_buf_new();   /* full: kept for stop */
+    if (!b) {
+        InterlockedDecrement(&g_trace_busy);
+        return;
+    }
+
+    TraceEvent *e = &b->ev[b->head];
+    e->name  = name;
+    e->cat   = cat;
+    e->start = start;
+    e->dur   = now.QuadPart - start;
+    e->arg[0] = 0;
+    if (arg) {
+        size_t len = strlen(arg);
+        if (len >= sizeof(e->arg)) {
+            arg += len - (sizeof(e->arg) - 1);
+            while ((*arg & 0xC0) == 0x80) arg++;   /* not mid UTF-8 sequence */
+        }
+        strncpy(e->arg, arg, sizeof(e->arg) - 1);
+        e->arg[sizeof(e->arg) - 1] = 0;
+    }
+    InterlockedIncrement(&b->head);               /* publish */
+    InterlockedDecrement(&g_trace_busy);
+}
+
+static int trace_start(FILE *file, tray_trace_sink sink, void *user)
+{
+    if (g_trace_on) return -1;
+    if (g_trace_tls == TLS_OUT_OF_INDEXES) {
+        g_trace_tls = TlsAlloc();
+        if (g_trace_tls == TLS_OUT_OF_INDEXES) return -1;
+        InitializeCriticalSection(&trace_cs);
+    }
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    EnterCriticalSection(&trace_cs);
+    g_trace_file        = file;
+    g_trace_sink        = sink;
+    g_trace_user        = user;
+    g_trace_first       = TRUE;
+    g_trace_ns_per_tick = 1e9 / (double)freq.QuadPart;
+    g_trace_pid         = GetCurrentProcessId();
+    static const char head[] = "{\"traceEvents\":[\n";
+    trace_write(head, sizeof(head) - 1);
+    LeaveCriticalSection(&trace_cs);
+
+    InterlockedExchange(&g_trace_on, 1);
+    return 0;
+}
 
 /* -------------------------------------------------------------------------- */
 /*  Critical section helper                                                   */
@@ -127,6 +647,29 @@ static void ensure_critical_section(void)
     }
 }
 
+/* tray_cs; while tracing, contended acquisitions are recorded as spans */
+static void tray_lock(void)
+{
+    if (!g_trace_on) {
+        EnterCriticalSection(&tray_cs);
+        return;
+    }
+    if (TryEnterCriticalSection(&tray_cs)) return;
+    LONGLONG t = trace_begin();
+    EnterCriticalSection(&tray_cs);
+    trace_end(t, "tray_cs wait", "lock", NULL);
+}
+
+/* Shell_NotifyIconW, traced: the call waits on Explorer */
+static BOOL tray_notify(DWORD msg, NOTIFYICONDATAW *data)
+{
+    LONGLONG t = trace_begin();
+    BOOL ok = Shell_NotifyIconW(msg, data);
+    trace_end(t, "Shell_NotifyIconW", "shell",
+              msg == NIM_ADD ? "NIM_ADD" : msg == NIM_MODIFY ? "NIM_MODIFY" : "NIM_DELETE");
+    return ok;
+}
+
 /* -------------------------------------------------------------------------- */
 /*  Context helpers                                                            */
 /* -------------------------------------------------------------------------- */
@@ -176,7 +719,6 @@ static TrayContext* create_ctx(struct tray *t)
     if (!ctx) return NULL;
     ctx->tray     = t;
     ctx->hwnd     = NULL;
-    ctx->hmenu    = NULL;
     ZeroMemory(&ctx->nid, sizeof(ctx->nid));
     ctx->uID      = g_next_uid++;
     ctx->threadId = GetCurrentThreadId();
@@ -201,26 +743,19 @@ static void destroy_ctx(TrayContext *ctx)
         if (prev) prev->next = ctx->next;
     }
 
-    /* Free menu */
-    if (ctx->hmenu) {
-        MENUITEMINFOW item = {0};
-        item.cbSize = sizeof(item);
-        item.fMask = MIIM_BITMAP;
-        int count = GetMenuItemCount(ctx->hmenu);
-        for (int i = 0; i < count; i++) {
-            if (GetMenuItemInfoW(ctx->hmenu, i, TRUE, &item)) {
-                if (item.hbmpItem && item.hbmpItem != HBMMENU_CALLBACK) {
-                    DeleteObject(item.hbmpItem);
-                }
-            }
-        }
-        DestroyMenu(ctx->hmenu);
-        ctx->hmenu = NULL;
-    }
+    /* Free menu; the generation of an open popup is left to the popup */
+    icon_job_cancel(&ctx->notify_job);
+    wstr_release(ctx->icon_path);
+    ctx->icon_path = NULL;
+    if (ctx->menu != ctx->open_menu) menu_gen_free(ctx->menu);
+    ctx->menu = NULL;
+    free(ctx->shape);
+    ctx->shape = NULL;
 
-    /* Destroy window */
+    /* Destroy window; decoded icons still queued for it are dropped */
     if (ctx->hwnd) {
         DestroyWindow(ctx->hwnd);
+        icon_job_reclaim(ctx->hwnd);
         ctx->hwnd = NULL;
     }
 
@@ -230,77 +765,634 @@ static void destroy_ctx(TrayContext *ctx)
         ctx->nid.hIcon = NULL;
     }
 
+    /* TrackPopupMenu still runs on open_menu without tray_cs: the popup
+       frees the generation and the context once it returns */
+    if (ctx->open_menu) {
+        ctx->exiting = TRUE;
+        g_ctx_pinned++;
+        return;
+    }
     free(ctx);
 }
 
+/* No tray left: drops process-wide state. Caller holds tray_cs, which is
+   released and deleted. */
+static void tray_shutdown_locked(void)
+{
+    UnregisterClassW(WC_TRAY_CLASS_NAME, GetModuleHandleW(NULL));
+    wstr_clear();
+    LeaveCriticalSection(&tray_cs);
+    DeleteCriticalSection(&tray_cs);
+    cs_initialized = FALSE;
+}
+
 /* ------------------------------------------------------------------ */
-/*  Safe conversion of an HICON to ARGB 32-bit bitmap                */
+/*  ICO/PNG files: mapped read-only, one entry decoded to BGRA        */
 /* ------------------------------------------------------------------ */
-static HBITMAP bitmap_from_icon(HICON hIcon, int cx, int cy)
+
+/* w x h premultiplied BGRA into out; FALSE if the file is not ICO/PNG
+   (or unsupported), so the caller can fall back to LoadImageW */
+static BOOL icon_file_decode(const WStr *path, DWORD *out, int w, int h, int stride)
 {
-    if (!hIcon) return NULL;
+    HANDLE file = CreateFileW(path->wide, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return FALSE;
+
+    BOOL ok = FALSE;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && size.QuadPart <= TRAY_ICON_FILE_MAX) {
+        HANDLE map = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map) {
+            const unsigned char *data = (const unsigned char *)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+            if (data) {
+                __try {
+                    ok = tray_ico_decode(data, (size_t)size.QuadPart,
+                                         (unsigned int *)out, w, h, stride) == 0;
+                } __except(EXCEPTION_EXECUTE_HANDLER) {
+                    ok = FALSE;        /* read error while paging in the view */
+                }
+                UnmapViewOfFile(data);
+            }
+            CloseHandle(map);
+        }
+    }
+    CloseHandle(file);
+    return ok;
+}
 
+/* HICON of px x px from an ICO/PNG file, NULL if it cannot be decoded */
+static HICON icon_file_load(const WStr *path, int px)
+{
     BITMAPINFO bi = {0};
     bi.bmiHeader.biSize        = sizeof(bi.bmiHeader);
-    bi.bmiHeader.biWidth       = cx;
-    bi.bmiHeader.biHeight      = -cy;          /* top-down orientation */
+    bi.bmiHeader.biWidth       = px;
+    bi.bmiHeader.biHeight      = -px;              /* top-down, like the decoder */
     bi.bmiHeader.biPlanes      = 1;
-    bi.bmiHeader.biBitCount    = 32;           /* BGRA */
+    bi.bmiHeader.biBitCount    = 32;
     bi.bmiHeader.biCompression = BI_RGB;
 
-    void   *bits = NULL;
-    HDC     hdc  = GetDC(NULL);
-    HBITMAP hbmp = CreateDIBSection(hdc, &bi, DIB_RGB_COLORS, &bits, NULL, 0);
-    if (hbmp) {
-        HDC hdcMem   = CreateCompatibleDC(hdc);
-        HBITMAP hold = (HBITMAP)SelectObject(hdcMem, hbmp);
-
-        DrawIconEx(hdcMem, 0, 0, hIcon, cx, cy, 0, NULL, DI_NORMAL);
+    void *bits = NULL;
+    HDC screen = GetDC(NULL);
+    HBITMAP color = CreateDIBSection(screen, &bi, DIB_RGB_COLORS, &bits, NULL, 0);
+    ReleaseDC(NULL, screen);
+    if (!color) return NULL;
 
-        SelectObject(hdcMem, hold);
-        DeleteDC(hdcMem);
+    HICON icon = NULL;
+    if (icon_file_decode(path, (DWORD *)bits, px, px, px * 4)) {
+        /* Icon color bitmaps carry straight alpha */
+        DWORD *p = (DWORD *)bits;
+        for (int i = 0; i < px * px; i++) {
+            DWORD a = p[i] >> 24;
+            if (a == 0 || a == 255) continue;
+            p[i] = (a << 24) |
+                   ((((p[i] >> 16) & 0xFF) * 255 / a) << 16) |
+                   ((((p[i] >> 8)  & 0xFF) * 255 / a) << 8)  |
+                    (((p[i])       & 0xFF) * 255 / a);
+        }
+        BYTE *mask_bits = (BYTE *)calloc((size_t)((px + 15) / 16) * 2 * px, 1);
+        HBITMAP mask = mask_bits ? CreateBitmap(px, px, 1, 1, mask_bits) : NULL;
+        free(mask_bits);
+        if (mask) {
+            ICONINFO ii = {0};
+            ii.fIcon    = TRUE;
+            ii.hbmMask  = mask;
+            ii.hbmColor = color;
+            icon = CreateIconIndirect(&ii);
+            DeleteObject(mask);
+        }
     }
-    ReleaseDC(NULL, hdc);
-    return hbmp;
+    DeleteObject(color);
+    return icon;
 }
 
 /* ------------------------------------------------------------------ */
-/*  Generic loading of icon/bitmap from disk → ARGB bitmap           */
+/*  Generic loading of icon/bitmap from disk, drawn into a 32-bit DC  */
 /* ------------------------------------------------------------------ */
-static HBITMAP load_icon_bitmap(const char *icon_path)
+static BOOL draw_icon_file(HDC dc, int x, int y, int cx, int cy, const WStr *path)
 {
-    if (!icon_path || !*icon_path) return NULL;
-
-    /* Convert UTF-8 path to Wide */
-    LPWSTR wpath = utf8_to_wide(icon_path);
-    if (!wpath) return NULL;
-
-    /* 1st: try direct .bmp/.png as 32-bit DIB */
+    /* 1st: try direct .bmp/.png as DIB */
     HBITMAP hbmp = (HBITMAP)LoadImageW(
-        NULL, wpath,
+        NULL, path->wide,
         IMAGE_BITMAP,
-        16, 16,
+        cx, cy,
         LR_LOADFROMFILE | LR_CREATEDIBSECTION | LR_DEFAULTSIZE
     );
     if (hbmp) {
-        free(wpath);
-        return hbmp;
+        HDC src = CreateCompatibleDC(dc);
+        HGDIOBJ old = SelectObject(src, hbmp);
+        BOOL ok = BitBlt(dc, x, y, cx, cy, src, 0, 0, SRCCOPY);
+        SelectObject(src, old);
+        DeleteDC(src);
+        DeleteObject(hbmp);
+        return ok;
     }
 
-    /* 2nd: try .ico → ARGB conversion */
-    HICON hIcon = (HICON)LoadImageW(
-        NULL, wpath,
-        IMAGE_ICON,
-        16, 16,
-        LR_LOADFROMFILE | LR_DEFAULTSIZE
-    );
-    free(wpath);
+    /* 2nd: try .ico, alpha channel preserved by DrawIconEx */
+    HICON hIcon = (HICON)LoadImageW(
+        NULL, path->wide,
+        IMAGE_ICON,
+        cx, cy,
+        LR_LOADFROMFILE | LR_DEFAULTSIZE
+    );
+    if (!hIcon) return FALSE;
+
+    BOOL ok = DrawIconEx(dc, x, y, hIcon, cx, cy, 0, NULL, DI_NORMAL);
+    DestroyIcon(hIcon);
+    return ok;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Icon atlas: pack, render and draw menu icons                      */
+/* ------------------------------------------------------------------ */
+static void icon_pages_release(IconPages *pages)
+{
+    if (!pages || InterlockedDecrement(&pages->refs) != 0) return;
+    for (int p = 0; p < pages->page_count; p++) {
+        if (pages->pages[p]) DeleteObject(pages->pages[p]);
+    }
+    free(pages->pages);
+    free(pages->bits);
+    free(pages);
+}
+
+static void icon_atlas_free(IconAtlas *atlas)
+{
+    if (!atlas) return;
+    for (UINT i = 0; i < atlas->cell_count; i++) wstr_release(atlas->paths[i]);
+    icon_pages_release(atlas->pages);
+    free(atlas->paths);
+    free(atlas->cells);
+    free(atlas);
+}
+
+/* Empty atlas for `cells` command IDs, or NULL if allocation fails */
+static IconAtlas *icon_atlas_new(UINT cells)
+{
+    IconAtlas *atlas = (IconAtlas *)calloc(1, sizeof(IconAtlas));
+    if (!atlas) return NULL;
+    atlas->cells = (tray_atlas_rect *)calloc(cells ? cells : 1, sizeof(*atlas->cells));
+    atlas->paths = (WStr **)calloc(cells ? cells : 1, sizeof(*atlas->paths));
+    if (!atlas->cells || !atlas->paths) {
+        icon_atlas_free(atlas);
+        return NULL;
+    }
+    atlas->cell_count = cells;
+    return atlas;
+}
+
+static BOOL wstr_same(const WStr *a, const WStr *b)
+{
+    return a == b || (a->hash == b->hash && a->len == b->len && !memcmp(a->key, b->key, a->len));
+}
+
+/* Build side, caller holds tray_cs: icons whose path the previous
+   generation already shows are drawn from its pages right away, and the
+   job copies their cells instead of decoding the file again. Returns the
+   atlas for the new generation to use until the job delivers, NULL when
+   nothing could be reused. */
+static IconAtlas *icon_atlas_reuse(const IconAtlas *prev, IconJob *job, UINT *reused)
+{
+    *reused = 0;
+    if (!prev || !prev->pages || !job || !job->count) return NULL;
+
+    /* Open addressing over the previous cells, keyed by path hash */
+    UINT size = 16;
+    while (size < 2 * prev->cell_count) size <<= 1;
+    UINT *table = (UINT *)malloc(size * sizeof(UINT));
+    IconAtlas *atlas = table ? icon_atlas_new(job->capacity) : NULL;
+    if (!atlas) {
+        free(table);
+        return NULL;
+    }
+    memset(table, 0xFF, size * sizeof(UINT));
+    for (UINT i = 0; i < prev->cell_count; i++) {
+        if (!prev->paths[i] || prev->cells[i].w <= 0) continue;
+        UINT k = prev->paths[i]->hash & (size - 1);
+        while (table[k] != (UINT)-1) k = (k + 1) & (size - 1);
+        table[k] = i;
+    }
+
+    for (UINT i = 0; i < job->count; i++) {
+        IconSlot *slot = &job->slots[i];
+        for (UINT k = slot->path->hash & (size - 1); table[k] != (UINT)-1; k = (k + 1) & (size - 1)) {
+            if (!wstr_same(prev->paths[table[k]], slot->path)) continue;
+            UINT cell = slot->cmd - ID_TRAY_FIRST;
+            slot->from          = prev->cells[table[k]];
+            atlas->cells[cell]  = slot->from;
+            atlas->paths[cell]  = slot->path;
+            InterlockedIncrement(&slot->path->refs);
+            (*reused)++;
+            break;
+        }
+    }
+    free(table);
+
+    if (!*reused) {
+        icon_atlas_free(atlas);
+        return NULL;
+    }
+    atlas->pages = prev->pages;
+    InterlockedIncrement(&atlas->pages->refs);      /* the new generation's */
+    job->src = prev->pages;
+    InterlockedIncrement(&job->src->refs);          /* the job's, to copy from */
+    return atlas;
+}
+
+/* Images without any alpha (plain bitmaps, legacy icons) get opaque pixels */
+static void icon_atlas_fix_alpha(BYTE *bits, int stride, const tray_atlas_rect *r)
+{
+    for (int y = r->y; y < r->y + r->h; y++) {
+        DWORD *row = (DWORD *)(bits + (size_t)y * stride) + r->x;
+        for (int x = 0; x < r->w; x++) {
+            if (row[x] & 0xFF000000) return;
+        }
+    }
+    for (int y = r->y; y < r->y + r->h; y++) {
+        DWORD *row = (DWORD *)(bits + (size_t)y * stride) + r->x;
+        for (int x = 0; x < r->w; x++) {
+            if (row[x]) row[x] |= 0xFF000000;
+        }
+    }
+}
+
+/* Copies a cell between pages of the same layout */
+static void icon_atlas_copy_cell(DWORD *dst, const tray_atlas_rect *to,
+                                 const DWORD *src, const tray_atlas_rect *from)
+{
+    for (int y = 0; y < to->h; y++) {
+        memcpy(dst + (size_t)(to->y + y) * TRAY_ATLAS_PAGE_SIZE + to->x,
+               src + (size_t)(from->y + y) * TRAY_ATLAS_PAGE_SIZE + from->x,
+               (size_t)to->w * sizeof(DWORD));
+    }
+}
+
+/* Worker side: decodes every slot of the job straight into atlas pages;
+   slots the previous pages already hold are copied from there */
+static IconAtlas *icon_atlas_build(IconJob *job)
+{
+    tray_atlas_rect *rects = (tray_atlas_rect *)calloc(job->count, sizeof(*rects));
+    IconAtlas *atlas = icon_atlas_new(job->capacity);
+    if (atlas) atlas->pages = (IconPages *)calloc(1, sizeof(IconPages));
+    if (!rects || !atlas || !atlas->pages) {
+        free(rects);
+        icon_atlas_free(atlas);
+        return NULL;
+    }
+    atlas->pages->refs = 1;
+
+    for (UINT i = 0; i < job->count; i++) {
+        rects[i].w = TRAY_MENU_ICON_SIZE;
+        rects[i].h = TRAY_MENU_ICON_SIZE;
+    }
+    int pages = tray_atlas_pack(rects, (int)job->count,
+                                TRAY_ATLAS_PAGE_SIZE, TRAY_ATLAS_PAGE_SIZE);
+    IconPages *store = atlas->pages;
+    if (pages > 0) {
+        store->pages = (HBITMAP *)calloc((size_t)pages, sizeof(HBITMAP));
+        store->bits  = (DWORD **)calloc((size_t)pages, sizeof(DWORD *));
+    }
+    if (!store->pages || !store->bits) {
+        free(rects);
+        icon_atlas_free(atlas);
+        return NULL;
+    }
+    store->page_count = pages;
+
+    HDC screen = GetDC(NULL);
+    HDC mem    = CreateCompatibleDC(screen);
+    for (int p = 0; p < pages && !job->cancelled; p++) {
+        BITMAPINFO bi = {0};
+        bi.bmiHeader.biSize        = sizeof(bi.bmiHeader);
+        bi.bmiHeader.biWidth       = TRAY_ATLAS_PAGE_SIZE;
+        bi.bmiHeader.biHeight      = -tray_atlas_page_height(rects, (int)job->count, p);
+        bi.bmiHeader.biPlanes      = 1;
+        bi.bmiHeader.biBitCount    = 32;       /* BGRA */
+        bi.bmiHeader.biCompression = BI_RGB;
+
+        void *bits = NULL;
+        store->pages[p] = CreateDIBSection(screen, &bi, DIB_RGB_COLORS, &bits, NULL, 0);
+        if (!store->pages[p]) continue;
+        store->bits[p] = (DWORD *)bits;
+
+        HGDIOBJ old = SelectObject(mem, store->pages[p]);
+        for (UINT i = 0; i < job->count && !job->cancelled; i++) {
+            const tray_atlas_rect *r = &rects[i];
+            const tray_atlas_rect *from = &job->slots[i].from;
+            if (r->page != p) continue;
+            if (from->w > 0 && job->src->bits[from->page]) {
+                icon_atlas_copy_cell((DWORD *)bits, r, job->src->bits[from->page], from);
+                atlas->cells[job->slots[i].cmd - ID_TRAY_FIRST] = *r;
+                atlas->paths[job->slots[i].cmd - ID_TRAY_FIRST] = job->slots[i].path;
+                InterlockedIncrement(&job->slots[i].path->refs);
+                continue;
+            }
+            LONGLONG t = trace_begin();
+            /* ICO/PNG decode straight into the page; LoadImageW for the rest */
+            DWORD *cell = (DWORD *)bits + (size_t)r->y * TRAY_ATLAS_PAGE_SIZE + r->x;
+            BOOL drawn = icon_file_decode(job->slots[i].path, cell, r->w, r->h,
+                                          TRAY_ATLAS_PAGE_SIZE * 4);
+            if (!drawn &&
+                draw_icon_file(mem, r->x, r->y, r->w, r->h, job->slots[i].path)) {
+                GdiFlush();
+                icon_atlas_fix_alpha((BYTE *)bits, TRAY_ATLAS_PAGE_SIZE * 4, r);
+                drawn = TRUE;
+            }
+            trace_end(t, "icon_load", "icon", job->slots[i].path->key);
+            if (drawn) {
+                atlas->cells[job->slots[i].cmd - ID_TRAY_FIRST] = *r;
+                atlas->paths[job->slots[i].cmd - ID_TRAY_FIRST] = job->slots[i].path;
+                InterlockedIncrement(&job->slots[i].path->refs);
+            }
+        }
+        SelectObject(mem, old);
+    }
+    DeleteDC(mem);
+    ReleaseDC(NULL, screen);
+
+    free(rects);
+    return atlas;
+}
+
+/* UI side: WM_DRAWITEM for an HBMMENU_CALLBACK item slices its atlas cell */
+static void icon_atlas_draw(const IconAtlas *atlas, const DRAWITEMSTRUCT *dis)
+{
+    if (!atlas || !atlas->pages || dis->itemID < ID_TRAY_FIRST) return;
+    if (dis->itemID - ID_TRAY_FIRST >= atlas->cell_count) return;
+
+    const tray_atlas_rect *r = &atlas->cells[dis->itemID - ID_TRAY_FIRST];
+    if (r->w <= 0 || !atlas->pages->pages[r->page]) return;
+
+    HDC mem = CreateCompatibleDC(dis->hDC);
+    HGDIOBJ old = SelectObject(mem, atlas->pages->pages[r->page]);
+    BLENDFUNCTION bf = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+    int y = dis->rcItem.top + (dis->rcItem.bottom - dis->rcItem.top - r->h) / 2;
+    AlphaBlend(dis->hDC, dis->rcItem.left, y, r->w, r->h,
+               mem, r->x, r->y, r->w, r->h, bf);
+    SelectObject(mem, old);
+    DeleteDC(mem);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Menu teardown: item bitmaps at every level, then the menu itself          */
+/* -------------------------------------------------------------------------- */
+static void tray_menu_free_bitmaps(HMENU menu)
+{
+    int count = GetMenuItemCount(menu);
+    for (int i = 0; i < count; i++) {
+        MENUITEMINFOW item = {0};
+        item.cbSize = sizeof(item);
+        item.fMask  = MIIM_BITMAP | MIIM_SUBMENU;
+        if (GetMenuItemInfoW(menu, i, TRUE, &item)) {
+            if (item.hbmpItem && item.hbmpItem != HBMMENU_CALLBACK) {
+                DeleteObject(item.hbmpItem);
+            }
+            if (item.hSubMenu) tray_menu_free_bitmaps(item.hSubMenu);
+        }
+    }
+}
+
+static void tray_menu_destroy(HMENU menu)
+{
+    if (!menu) return;
+    tray_menu_free_bitmaps(menu);
+    DestroyMenu(menu);                 /* also destroys the submenus */
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Background icon decoding                                                  */
+/* -------------------------------------------------------------------------- */
+/* Job with room for `capacity` menu icons, or NULL if allocation fails */
+static IconJob *icon_job_new(HWND h, UINT capacity)
+{
+    IconJob *job = (IconJob *)calloc(1, sizeof(IconJob));
+    if (!job) return NULL;
+    if (capacity) {
+        job->slots = (IconSlot *)calloc(capacity, sizeof(IconSlot));
+        if (!job->slots) { free(job); return NULL; }
+    }
+    job->refs     = 1;
+    job->hwnd     = h;
+    job->capacity = capacity;
+    return job;
+}
+
+static void icon_job_release(IconJob *job)
+{
+    if (!job || InterlockedDecrement(&job->refs) != 0) return;
+
+    for (UINT i = 0; i < job->count; i++) wstr_release(job->slots[i].path);
+    free(job->slots);
+    icon_pages_release(job->src);
+    icon_atlas_free(job->atlas);
+    wstr_release(job->tray_icon_path);
+    if (job->tray_icon) DestroyIcon(job->tray_icon);
+    free(job);
+}
+
+/* Drops a pending job of the context; a running worker stops at its next icon */
+static void icon_job_cancel(IconJob **slot)
+{
+    if (!*slot) return;
+    InterlockedExchange(&(*slot)->cancelled, 1);
+    icon_job_release(*slot);
+    *slot = NULL;
+}
+
+/* Jobs whose WM_TRAY_ICONS_READY is queued. The worker reference moves
+   here instead of into the message: a window destroyed before dispatch,
+   or a host that stops pumping after WM_QUIT, would leak it otherwise.
+   The lock outlives tray_cs, since workers can finish after tray_exit. */
+static CRITICAL_SECTION icon_posted_cs;
+static INIT_ONCE        icon_posted_once = INIT_ONCE_STATIC_INIT;
+static IconJob         *g_icon_posted    = NULL;
+
+static BOOL CALLBACK icon_posted_init_once(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once; (void)param; (void)ctx;
+    InitializeCriticalSection(&icon_posted_cs);
+    return TRUE;
+}
+
+static void icon_posted_lock(void)
+{
+    InitOnceExecuteOnce(&icon_posted_once, icon_posted_init_once, NULL, NULL);
+    EnterCriticalSection(&icon_posted_cs);
+}
+
+/* UI thread: takes the worker reference of a dispatched job. FALSE if
+   destroy_ctx reclaimed it first; the pointer must not be used then. */
+static BOOL icon_job_claim(IconJob *job)
+{
+    icon_posted_lock();
+    IconJob **p = &g_icon_posted;
+    while (*p && *p != job) p = &(*p)->posted_next;
+    BOOL found = *p != NULL;
+    if (found) *p = job->posted_next;
+    LeaveCriticalSection(&icon_posted_cs);
+    return found;
+}
+
+/* Drops the worker references of jobs posted to a destroyed window */
+static void icon_job_reclaim(HWND h)
+{
+    IconJob *mine = NULL;
+    icon_posted_lock();
+    for (IconJob **p = &g_icon_posted; *p;) {
+        IconJob *job = *p;
+        if (job->hwnd != h) { p = &job->posted_next; continue; }
+        *p = job->posted_next;
+        job->posted_next = mine;
+        mine = job;
+    }
+    LeaveCriticalSection(&icon_posted_cs);
+    while (mine) {
+        IconJob *next = mine->posted_next;
+        icon_job_release(mine);
+        mine = next;
+    }
+}
+
+/* Small icon for the notification area, sized for the system DPI. ICO
+   and PNG pick their best entry; other files go through the shell. */
+static HICON load_notify_icon(const WStr *path)
+{
+    LONGLONG t = trace_begin();
+    HDC screen = GetDC(NULL);
+    int px = MulDiv(TRAY_NOTIFY_ICON_SIZE, GetDeviceCaps(screen, LOGPIXELSY), 96);
+    ReleaseDC(NULL, screen);
+
+    HICON icon = icon_file_load(path, px);
+    if (!icon) ExtractIconExW(path->wide, 0, NULL, &icon, 1);
+    trace_end(t, "icon_load", "icon", path->key);
+    return icon;
+}
+
+/* Thread-pool worker: decodes every icon, then hands the job to the UI thread */
+static void CALLBACK icon_job_run(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    IconJob *job = (IconJob *)param;
+    (void)inst;
+
+    if (job->count) job->atlas = icon_atlas_build(job);
+    if (job->tray_icon_path && !job->cancelled) {
+        job->tray_icon = load_notify_icon(job->tray_icon_path);
+    }
+
+    /* This reference waits on g_icon_posted for the UI thread. Posting
+       under the lock: the handler cannot claim before the job is listed,
+       and destroy_ctx cancels first, so nothing is posted after it. */
+    icon_posted_lock();
+    BOOL posted = !job->cancelled &&
+                  PostMessageW(job->hwnd, WM_TRAY_ICONS_READY, 0, (LPARAM)job);
+    if (posted) {
+        job->posted_next = g_icon_posted;
+        g_icon_posted    = job;
+    }
+    LeaveCriticalSection(&icon_posted_cs);
+    if (!posted) icon_job_release(job);
+}
+
+/* Starts decoding into *slot; caller holds tray_cs. Empty jobs are dropped */
+static void icon_job_submit(IconJob **slot, IconJob *job)
+{
+    if (!job) return;
+    if (!job->count && !job->tray_icon_path) {
+        icon_job_release(job);
+        return;
+    }
+
+    *slot = job;
+    InterlockedIncrement(&job->refs);  /* worker reference */
+    if (!TrySubmitThreadpoolCallback(icon_job_run, job, NULL)) {
+        icon_job_run(NULL, job);       /* pool unavailable: decode inline */
+    }
+}
+
+/* UI thread: installs the atlas into the generation the job was built for */
+static void icon_job_apply_menu(MenuGen *gen, IconJob *job)
+{
+    /* Replaces the cells borrowed from the previous generation, if any */
+    if (job->atlas) {
+        icon_atlas_free(gen->atlas);
+        gen->atlas = job->atlas;
+        job->atlas = NULL;             /* now owned by the generation */
+    }
+
+    /* Icons that failed to load give their reserved space back */
+    for (UINT i = 0; i < job->count; i++) {
+        IconSlot *slot = &job->slots[i];
+        if (gen->atlas && gen->atlas->cells[slot->cmd - ID_TRAY_FIRST].w > 0) continue;
+
+        MENUITEMINFOW info = {0};
+        info.cbSize   = sizeof(info);
+        info.fMask    = MIIM_BITMAP;
+        info.hbmpItem = NULL;
+        SetMenuItemInfoW(gen->hmenu, slot->cmd, FALSE, &info);
+    }
+}
+
+/* UI thread: swaps the notification icon */
+static void icon_job_apply_tray(TrayContext *ctx, IconJob *job)
+{
+    if (job->tray_icon) {
+        if (ctx->nid.hIcon) DestroyIcon(ctx->nid.hIcon);
+        ctx->nid.hIcon  = job->tray_icon;
+        job->tray_icon  = NULL;
+        tray_notify(NIM_MODIFY, &ctx->nid);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Polled event queue                                                        */
+/* -------------------------------------------------------------------------- */
+static LONG event_load(volatile LONG *p)
+{
+    return InterlockedCompareExchange(p, 0, 0);   /* full barrier read */
+}
+
+/* a - b on the wrapping sequence counters */
+static LONG event_dist(LONG a, LONG b)
+{
+    return (LONG)((ULONG)a - (ULONG)b);
+}
+
+static void event_queue_init(void)
+{
+    if (g_events_ready) return;
+    for (LONG i = 0; i < TRAY_EVENT_QUEUE_SIZE; i++) g_events[i].seq = i;
+    InterlockedExchange(&g_events_ready, 1);
+}
 
-    if (hIcon) {
-        hbmp = bitmap_from_icon(hIcon, 16, 16);
-        DestroyIcon(hIcon);
+/* Queues one event; counts it as dropped when the ring is full */
+static void event_push(UINT tray_id, int item, int kind)
+{
+    LONG pos = event_load(&g_event_head);
+    for (;;) {
+        EventCell *cell = &g_events[pos & (TRAY_EVENT_QUEUE_SIZE - 1)];
+        LONG dif = event_dist(event_load(&cell->seq), pos);
+        if (dif == 0) {
+            LONG next = (LONG)((ULONG)pos + 1);
+            LONG seen = InterlockedCompareExchange(&g_event_head, next, pos);
+            if (seen == pos) {
+                POINT p = {0, 0};
+                GetCursorPos(&p);
+                cell->ev.tray_id   = tray_id;
+                cell->ev.item      = item;
+                cell->ev.kind      = kind;
+                cell->ev.x         = p.x;
+                cell->ev.y         = p.y;
+                cell->ev.timestamp = GetTickCount64();
+                InterlockedExchange(&cell->seq, next);       /* publish */
+                return;
+            }
+            pos = seen;
+        } else if (dif < 0) {
+            InterlockedIncrement(&g_events_dropped);          /* full */
+            return;
+        } else {
+            pos = event_load(&g_event_head);
+        }
     }
-    return hbmp;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -319,27 +1411,140 @@ static LRESULT CALLBACK tray_wnd_proc(HWND h, UINT msg, WPARAM w, LPARAM l)
         PostQuitMessage(0);
         return 0;
 
+    case WM_ENTERIDLE:
+        /* First idle of the menu loop: the popup is on screen */
+        if (w == MSGF_MENU && ctx && ctx->popup_pending) {
+            tray_lock();
+            tray_record_latency(ctx);
+            LeaveCriticalSection(&tray_cs);
+        }
+        break;
+
+    case WM_MEASUREITEM: {
+        MEASUREITEMSTRUCT *mis = (MEASUREITEMSTRUCT *)l;
+        if (mis->CtlType == ODT_MENU) {
+            mis->itemWidth  = TRAY_MENU_ICON_SIZE;
+            mis->itemHeight = TRAY_MENU_ICON_SIZE;
+            return TRUE;
+        }
+        break;
+    }
+
+    case WM_DRAWITEM: {
+        DRAWITEMSTRUCT *dis = (DRAWITEMSTRUCT *)l;
+        if (dis->CtlType == ODT_MENU) {
+            tray_lock();
+            /* Draw from the snapshot on screen, not a newer generation */
+            MenuGen *gen = ctx ? (ctx->open_menu ? ctx->open_menu : ctx->menu) : NULL;
+            if (gen) icon_atlas_draw(gen->atlas, dis);
+            LeaveCriticalSection(&tray_cs);
+            return TRUE;
+        }
+        break;
+    }
+
+    case WM_TRAY_ICONS_READY: {
+        IconJob *job = (IconJob *)l;
+        if (!icon_job_claim(job)) return 0;   /* reclaimed by destroy_ctx */
+        tray_lock();
+        /* Applied to the generation that queued it (current or on screen);
+           results for freed generations were cancelled and are dropped */
+        MenuGen *gen = NULL;
+        if (ctx && ctx->menu && ctx->menu->icon_job == job)
+            gen = ctx->menu;
+        else if (ctx && ctx->open_menu && ctx->open_menu->icon_job == job)
+            gen = ctx->open_menu;
+        if (gen) {
+            icon_job_apply_menu(gen, job);
+            gen->icon_job = NULL;
+            icon_job_release(job);     /* generation reference */
+        } else if (ctx && ctx->notify_job == job) {
+            icon_job_apply_tray(ctx, job);
+            ctx->notify_job = NULL;
+            icon_job_release(job);     /* context reference */
+        }
+        LeaveCriticalSection(&tray_cs);
+        icon_job_release(job);         /* worker reference */
+        return 0;
+    }
+
     case WM_TRAY_CALLBACK_MESSAGE:
+        /* Polled mode queues every left click, cb or not; the cb pointer
+           only decides whether the menu opens as well */
+        if (l == WM_LBUTTONUP && ctx && g_event_mode)
+            event_push(ctx->uID, 0, TRAY_EVENT_CLICK);
         if (l == WM_LBUTTONUP && ctx && ctx->tray && ctx->tray->cb) {
-            EnterCriticalSection(&tray_cs);
-            if (ctx && ctx->tray && ctx->tray->cb) {
+            if (g_event_mode) return 0;
+            tray_lock();
+            if (ctx->tray && ctx->tray->cb) {
+                LONGLONG t = trace_begin();
                 ctx->tray->cb(ctx->tray);
+                trace_end(t, "callback", "callback", "tray");
             }
             LeaveCriticalSection(&tray_cs);
             return 0;
         }
+        /* Pointer over the icon: get the menu ready before the click.
+           NIN_POPUPOPEN only arrives with NOTIFYICON_VERSION_4. */
+        if (l == WM_MOUSEMOVE
+#ifdef NIN_POPUPOPEN
+            || l == NIN_POPUPOPEN
+#endif
+            ) {
+            tray_lock();
+            if (ctx) tray_prepare_menu(ctx);
+            LeaveCriticalSection(&tray_cs);
+            return 0;
+        }
         if (l == WM_LBUTTONUP || l == WM_RBUTTONUP) {
+            LARGE_INTEGER clicked;
+            QueryPerformanceCounter(&clicked);
             POINT p;
             GetCursorPos(&p);
             SetForegroundWindow(h);
 
-            EnterCriticalSection(&tray_cs);
-            if (ctx && ctx->hmenu) {
-                WORD cmd = TrackPopupMenu(ctx->hmenu,
-                                          TPM_LEFTALIGN | TPM_RIGHTBUTTON |
-                                          TPM_RETURNCMD | TPM_NONOTIFY,
-                                          p.x, p.y, 0, h, NULL);
-                SendMessage(h, WM_COMMAND, cmd, 0);
+            tray_lock();
+            ctx = find_ctx_by_hwnd(h);          /* under the lock this time */
+            BOOL cold = ctx && (ctx->startup_pending || ctx->menu_dirty);
+            if (ctx) tray_prepare_menu(ctx);    /* no hover beat the click */
+            MenuGen *gen = ctx ? ctx->menu : NULL;
+            if (gen && gen->hmenu && !ctx->open_menu) {
+                ctx->open_menu     = gen;       /* pinned until the popup closes */
+                ctx->popup_pending = TRUE;
+                ctx->click_time    = clicked;
+                if (cold) ctx->latency.cold++;
+            } else {
+                gen = NULL;
+            }
+            LeaveCriticalSection(&tray_cs);
+            if (!gen) return 0;
+
+            /* Modal loop runs unlocked: updates from other threads only mark
+               the menu dirty or build a new generation next to this one.
+               No TPM_NONOTIFY: WM_ENTERIDLE marks the popup as shown. */
+            WORD cmd = TrackPopupMenu(gen->hmenu,
+                                      TPM_LEFTALIGN | TPM_RIGHTBUTTON |
+                                      TPM_RETURNCMD,
+                                      p.x, p.y, 0, h, NULL);
+
+            /* ctx stays allocated while open_menu is set, even when tray_exit
+               ran meanwhile; then the pick is dropped */
+            tray_lock();
+            if (!ctx->exiting) {
+                ctx->popup_pending = FALSE;
+                SendMessage(h, WM_COMMAND, cmd, 0);   /* resolves against gen */
+            }
+            ctx->open_menu = NULL;
+            if (ctx->exiting) {                   /* also from the callback */
+                menu_gen_free(gen);
+                icon_job_reclaim(h);              /* posted while on screen */
+                free(ctx);
+                if (--g_ctx_pinned == 0 && !g_ctx_head) {
+                    tray_shutdown_locked();
+                    return 0;
+                }
+            } else if (ctx->menu != gen) {
+                menu_gen_free(gen);               /* superseded meanwhile */
             }
             LeaveCriticalSection(&tray_cs);
             return 0;
@@ -348,14 +1553,23 @@ static LRESULT CALLBACK tray_wnd_proc(HWND h, UINT msg, WPARAM w, LPARAM l)
 
     case WM_COMMAND:
         if (w >= ID_TRAY_FIRST) {
-            EnterCriticalSection(&tray_cs);
-            if (ctx && ctx->hmenu) {
-                MENUITEMINFOW item = { 0 };
-                item.cbSize = sizeof(item);
-                item.fMask = MIIM_ID | MIIM_DATA;
-                if (GetMenuItemInfoW(ctx->hmenu, (UINT)w, FALSE, &item)) {
-                    struct tray_menu_item *mi = (struct tray_menu_item *)item.dwItemData;
-                    if (mi && mi->cb) mi->cb(mi);
+            tray_lock();
+            /* The command ID belongs to the generation that was on screen;
+               its slots were copied at build time, the items are not read */
+            MenuGen *gen = ctx ? (ctx->open_menu ? ctx->open_menu : ctx->menu) : NULL;
+            UINT index = (UINT)w - ID_TRAY_FIRST;
+            MenuSlot *slot = gen && index < gen->item_count ? &gen->items[index] : NULL;
+            /* Polled mode needs no cb: every selectable item is queued */
+            if (slot && slot->item && g_event_mode) {
+                event_push(ctx->uID, TRAY_ITEM_HANDLE(gen->layout, (UINT)w),
+                           TRAY_EVENT_MENU_ITEM);
+            } else if (slot && slot->item && slot->cb) {
+                LONGLONG t = trace_begin();
+                slot->cb(slot->item);
+                if (t) {
+                    char id[16];
+                    snprintf(id, sizeof(id), "item %u", (UINT)w);
+                    trace_end(t, "callback", "callback", id);
                 }
             }
             LeaveCriticalSection(&tray_cs);
@@ -366,7 +1580,7 @@ static LRESULT CALLBACK tray_wnd_proc(HWND h, UINT msg, WPARAM w, LPARAM l)
     default:
         if (msg == wm_taskbarcreated) {
             if (ctx) {
-                Shell_NotifyIconW(NIM_ADD, &ctx->nid);
+                tray_notify(NIM_ADD, &ctx->nid);
             }
             return 0;
         }
@@ -374,10 +1588,49 @@ static LRESULT CALLBACK tray_wnd_proc(HWND h, UINT msg, WPARAM w, LPARAM l)
     return DefWindowProcW(h, msg, w, l);
 }
 
+/* -------------------------------------------------------------------------- */
+/*  Number of command IDs a menu tree will consume                            */
+/* -------------------------------------------------------------------------- */
+static UINT tray_menu_count(struct tray_menu_item *m)
+{
+    UINT n = 0;
+    for (; m && m->text; ++m) {
+        if (!*m->text || strcmp(m->text, "-") == 0) continue;
+        n++;
+        if (m->submenu) n += tray_menu_count(m->submenu);
+    }
+    return n;
+}
+
+/* Layout of a menu tree, one byte per entry: 'i' item, '-' separator, 'x'
+   empty text (skipped with its submenu, no command ID) and '(' ')' around
+   submenus. Equal layouts assign equal command IDs. out may be NULL to
+   measure. */
+static UINT tray_menu_shape(struct tray_menu_item *m, unsigned char *out)
+{
+    UINT n = 0;
+    for (; m && m->text; ++m) {
+        BOOL sep  = strcmp(m->text, "-") == 0;
+        BOOL skip = !*m->text;
+        if (out) out[n] = sep ? '-' : skip ? 'x' : 'i';
+        n++;
+        if (sep || skip || !m->submenu) continue;
+        if (out) out[n] = '(';
+        n++;
+        n += tray_menu_shape(m->submenu, out ? out + n : NULL);
+        if (out) out[n] = ')';
+        n++;
+    }
+    return n;
+}
+
 /* -------------------------------------------------------------------------- */
 /*  Recursive HMENU construction with safe icon support                       */
+/*  items (optional) receives each item at index command ID - ID_TRAY_FIRST   */
+/*  job (optional) collects icon paths; job->slots must hold one per item     */
 /* -------------------------------------------------------------------------- */
-static HMENU tray_menu_item(struct tray_menu_item *m, UINT *id)
+static HMENU tray_menu_item(struct tray_menu_item *m, UINT *id,
+                            MenuSlot *items, IconJob *job)
 {
     HMENU menu = CreatePopupMenu();
     if (!menu) return NULL;
@@ -390,59 +1643,215 @@ static HMENU tray_menu_item(struct tray_menu_item *m, UINT *id)
             continue;
         }
 
+        /* Empty text: no entry and no command ID, like tray_menu_shape */
+        if (!*m->text) continue;
+
         /* Normal item (text + optional icon + submenu) */
         MENUITEMINFOW info;
         ZeroMemory(&info, sizeof(info));
         info.cbSize = sizeof(info);
 
-        /* Convert UTF-8 text to Wide */
-        LPWSTR wtext = utf8_to_wide(m->text);
-        if (!wtext) continue;
+        /* UTF-16 text, shared with previous builds of the same label */
+        WStr *wtext = wstr_intern(m->text);
+        if (!wtext) {
+            /* Out of memory: leave the item out but keep later IDs in place */
+            *id += 1 + tray_menu_count(m->submenu);
+            continue;
+        }
 
         /* Text: MIIM_STRING + MFT_STRING instead of MIIM_TYPE */
-        info.fMask      = MIIM_ID | MIIM_STRING | MIIM_STATE |
-                          MIIM_FTYPE | MIIM_DATA;
+        info.fMask      = MIIM_ID | MIIM_STRING | MIIM_STATE | MIIM_FTYPE;
         info.fType      = MFT_STRING;
-        info.dwTypeData = wtext;
-        info.cch        = (UINT)wcslen(wtext);
+        info.dwTypeData = wtext->wide;
+        info.cch        = wtext->wlen;
 
         /* Unique identifier */
         info.wID        = (*id)++;
-        info.dwItemData = (ULONG_PTR)m;
+        if (items) {
+            items[info.wID - ID_TRAY_FIRST].item = m;
+            items[info.wID - ID_TRAY_FIRST].cb   = m->cb;
+        }
 
         /* Optional submenu */
         if (m->submenu) {
             info.fMask   |= MIIM_SUBMENU;
-            info.hSubMenu = tray_menu_item(m->submenu, id);
+            info.hSubMenu = tray_menu_item(m->submenu, id, items, job);
         }
 
         /* State (disabled / checked) */
         if (m->disabled) info.fState |= MFS_DISABLED;
         if (m->checked)  info.fState |= MFS_CHECKED;
 
-        /* Optional icon */
-        if (m->icon_path && *m->icon_path) {
-            HBITMAP hBmp = load_icon_bitmap(m->icon_path);
-            if (hBmp) {
+        /* Optional icon: queued for the background decoder, drawn from the
+           atlas through WM_MEASUREITEM/WM_DRAWITEM once it is ready */
+        if (m->icon_path && *m->icon_path && job) {
+            IconSlot *slot = &job->slots[job->count];
+            slot->path = wstr_intern(m->icon_path);
+            if (slot->path) {
+                slot->cmd      = info.wID;
                 info.fMask    |= MIIM_BITMAP;
-                info.hbmpItem  = hBmp;
+                info.hbmpItem  = HBMMENU_CALLBACK;
+                job->count++;
             }
         }
 
         /* Append at end of menu to avoid out-of-range indexes */
         InsertMenuItemW(menu, (UINT)-1, TRUE, &info);
 
-        free(wtext);
+        wstr_release(wtext);                      /* the menu keeps a copy */
     }
     return menu;
 }
 
+/* -------------------------------------------------------------------------- */
+/*  Menu generations; caller holds tray_cs                                    */
+/* -------------------------------------------------------------------------- */
+
+/* Frees a generation; icons still decoding for it are dropped */
+static void menu_gen_free(MenuGen *gen)
+{
+    if (!gen) return;
+    icon_job_cancel(&gen->icon_job);
+    tray_menu_destroy(gen->hmenu);
+    icon_atlas_free(gen->atlas);
+    free(gen->items);
+    free(gen);
+}
+
+/* Builds a new generation from ctx->tray and makes it current. The old one
+   is freed unless a popup still shows it; the popup frees it on close. */
+static void tray_build_menu(TrayContext *ctx)
+{
+    LONGLONG t   = trace_begin();
+    MenuGen *old = ctx->menu;
+    ctx->menu       = NULL;
+    ctx->menu_dirty = FALSE;
+
+    MenuGen *gen = (MenuGen *)calloc(1, sizeof(MenuGen));
+    if (!gen) {
+        if (old != ctx->open_menu) menu_gen_free(old);
+        return;
+    }
+
+    struct tray_menu_item *menu = ctx->tray ? ctx->tray->menu : NULL;
+
+    /* Item table for picks and handle lookups (slots skipped by the build
+       stay empty) */
+    UINT count = tray_menu_count(menu);
+    if (count) {
+        gen->items = (MenuSlot *)calloc(count, sizeof(*gen->items));
+        if (gen->items) gen->item_count = count;
+    }
+
+    /* Icons are decoded off the UI thread; the menu is usable right away */
+    IconJob *job = icon_job_new(ctx->hwnd, count);
+
+    UINT   id = ID_TRAY_FIRST;
+    gen->hmenu = tray_menu_item(menu, &id, gen->items, job);
+
+    /* Paths the previous generation shows keep their pixels: drawn from
+       its pages right away and copied by the job, so a build that only
+       flips a checkbox decodes nothing */
+    UINT reused = 0;
+    gen->atlas = icon_atlas_reuse(old ? old->atlas : NULL, job, &reused);
+    if (old != ctx->open_menu) menu_gen_free(old);
+    if (job && reused == job->count) {
+        icon_job_release(job);
+        job = NULL;
+    }
+    icon_job_submit(&gen->icon_job, job);
+
+    /* Same layout as before: handles handed out earlier stay valid */
+    UINT len = tray_menu_shape(menu, NULL);
+    unsigned char *shape = (unsigned char *)malloc(len ? len : 1);
+    if (shape) tray_menu_shape(menu, shape);
+    if (!shape || !ctx->layout || len != ctx->shape_len || memcmp(shape, ctx->shape, len)) {
+        free(ctx->shape);
+        ctx->shape     = shape;
+        ctx->shape_len = shape ? len : 0;
+        ctx->layout    = g_next_layout;
+        g_next_layout  = g_next_layout == 0xFFFF ? 1 : g_next_layout + 1;
+    } else {
+        free(shape);
+    }
+    gen->layout = ctx->layout;
+    ctx->menu = gen;
+    trace_end(t, "menu_build", "menu", NULL);
+}
+
+/* Tooltip into ctx->nid (flags included); caller sends NIM_ADD/NIM_MODIFY */
+static void tray_set_tooltip(TrayContext *ctx, struct tray *tray)
+{
+    ctx->nid.uFlags = NIF_ICON | NIF_MESSAGE;
+    if (tray->tooltip && *tray->tooltip) {
+        WStr *wtooltip = wstr_intern(tray->tooltip);
+        if (wtooltip) {
+            wcsncpy_s(ctx->nid.szTip, sizeof(ctx->nid.szTip)/sizeof(WCHAR), wtooltip->wide, _TRUNCATE);
+            ctx->nid.uFlags |= NIF_TIP;
+            wstr_release(wtooltip);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Fast start: deferred dark mode and menu build                             */
+/* -------------------------------------------------------------------------- */
+static double elapsed_ms(LARGE_INTEGER since)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)(now.QuadPart - since.QuadPart) * 1000.0 / (double)freq.QuadPart;
+}
+
+/* UI thread, caller holds tray_cs; no-op unless tray_init_ex deferred work */
+static void tray_finish_startup(TrayContext *ctx)
+{
+    if (!ctx->startup_pending) return;
+    ctx->startup_pending = FALSE;
+
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    tray_enable_dark_mode_safe();
+    ctx->timings.dark_mode_ms = elapsed_ms(t);
+
+    QueryPerformanceCounter(&t);
+    if (ctx->menu_dirty) tray_build_menu(ctx);
+    ctx->timings.menu_ms  = elapsed_ms(t);
+    ctx->timings.total_ms = elapsed_ms(ctx->init_start);
+}
+
+/* Brings the menu up to date before it is shown; caller holds tray_cs */
+static void tray_prepare_menu(TrayContext *ctx)
+{
+    tray_finish_startup(ctx);
+    if (ctx->menu_dirty) tray_build_menu(ctx);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Click-to-popup latency                                                    */
+/* -------------------------------------------------------------------------- */
+static void tray_record_latency(TrayContext *ctx)
+{
+    double ms = elapsed_ms(ctx->click_time);
+    struct tray_menu_latency *l = &ctx->latency;
+
+    ctx->popup_pending = FALSE;
+    l->last_ms = ms;
+    if (!l->count || ms < l->min_ms) l->min_ms = ms;
+    if (!l->count || ms > l->max_ms) l->max_ms = ms;
+    l->count++;
+    ctx->latency_sum_ms += ms;
+    l->avg_ms = ctx->latency_sum_ms / l->count;
+}
+
 /* -------------------------------------------------------------------------- */
 /*  Public API                                                                */
 /* -------------------------------------------------------------------------- */
 struct tray *tray_get_instance(void) {
     ensure_critical_section();
-    EnterCriticalSection(&tray_cs);
+    tray_lock();
     TrayContext *ctx = find_ctx_by_thread(GetCurrentThreadId());
     if (!ctx) ctx = g_ctx_head; /* fallback */
     struct tray *t = ctx ? ctx->tray : NULL;
@@ -454,21 +1863,31 @@ struct tray *tray_get_instance(void) {
 /*  Initializes the tray icon and creates the hidden message window           */
 /* -------------------------------------------------------------------------- */
 int tray_init(struct tray *tray)
+{
+    return tray_init_ex(tray, 0);
+}
+
+int tray_init_ex(struct tray *tray, unsigned int flags)
 {
     if (!tray) return -1;
 
+    LARGE_INTEGER start, t;
+    QueryPerformanceCounter(&start);
+    LONGLONG span = trace_begin();
+    BOOL fast = (flags & TRAY_INIT_FAST) != 0;
+
     ensure_critical_section();
 
-    /* Wrap in SEH: tray_enable_dark_mode uses undocumented ordinal 135 of
-       uxtheme.dll which may cause an access violation on some Windows 10 builds. */
-    __try {
-        tray_enable_dark_mode();
-    } __except(EXCEPTION_EXECUTE_HANDLER) {
-        /* Silently ignore – dark-mode theming is cosmetic only. */
+    double dark_ms = 0.0;
+    if (!fast) {
+        QueryPerformanceCounter(&t);
+        tray_enable_dark_mode_safe();
+        dark_ms = elapsed_ms(t);
     }
     wm_taskbarcreated = RegisterWindowMessageW(L"TaskbarCreated");
 
     // Register (ignore if the class already exists)
+    QueryPerformanceCounter(&t);
     ZeroMemory(&wc, sizeof(wc));
     wc.cbSize        = sizeof(wc);
     wc.lpfnWndProc   = tray_wnd_proc;
@@ -476,13 +1895,15 @@ int tray_init(struct tray *tray)
     wc.lpszClassName = WC_TRAY_CLASS_NAME;
     if (!RegisterClassExW(&wc) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS)
         return -1;
+    double register_ms = elapsed_ms(t);
 
-    EnterCriticalSection(&tray_cs);
+    tray_lock();
     TrayContext *ctx = find_ctx_by_tray(tray);
     if (!ctx) ctx = create_ctx(tray);
     LeaveCriticalSection(&tray_cs);
     if (!ctx) return -1;
 
+    QueryPerformanceCounter(&t);
     ctx->hwnd = CreateWindowExW(
         0,
         WC_TRAY_CLASS_NAME,
@@ -494,6 +1915,13 @@ int tray_init(struct tray *tray)
         GetModuleHandleW(NULL),
         NULL);
     if (!ctx->hwnd) return -1;
+    double window_ms = elapsed_ms(t);
+
+    ZeroMemory(&ctx->timings, sizeof(ctx->timings));
+    ctx->init_start             = start;
+    ctx->timings.dark_mode_ms   = dark_ms;
+    ctx->timings.register_ms    = register_ms;
+    ctx->timings.window_ms      = window_ms;
 
     ZeroMemory(&ctx->nid, sizeof(ctx->nid));
     ctx->nid.cbSize           = sizeof(ctx->nid);
@@ -501,9 +1929,43 @@ int tray_init(struct tray *tray)
     ctx->nid.uID              = ctx->uID;
     ctx->nid.uFlags           = NIF_ICON | NIF_MESSAGE;
     ctx->nid.uCallbackMessage = WM_TRAY_CALLBACK_MESSAGE;
-    Shell_NotifyIconW(NIM_ADD, &ctx->nid);
 
+    if (fast) {
+        /* Icon and tooltip go in with NIM_ADD; everything else waits for
+           the first idle tray_loop() or the first click. The file is
+           decoded before taking tray_cs, which only covers the NIM_ADD */
+        QueryPerformanceCounter(&t);
+        WStr *icon_path = wstr_intern(tray->icon_filepath);
+        HICON icon = icon_path ? load_notify_icon(icon_path) : NULL;
+        tray_lock();
+        ctx->icon_path = icon_path;
+        ctx->nid.hIcon = icon;
+        tray_set_tooltip(ctx, tray);
+        tray_notify(NIM_ADD, &ctx->nid);
+        ctx->menu_dirty      = TRUE;
+        ctx->startup_pending = TRUE;
+        ctx->timings.icon_ms    = elapsed_ms(t);
+        ctx->timings.visible_ms = elapsed_ms(start);
+        LeaveCriticalSection(&tray_cs);
+        trace_end(span, "tray_init", "init", "fast");
+        return 0;
+    }
+
+    QueryPerformanceCounter(&t);
+    tray_notify(NIM_ADD, &ctx->nid);
+    ctx->timings.icon_ms    = elapsed_ms(t);
+    ctx->timings.visible_ms = elapsed_ms(start);
+
+    /* Full start returns with the menu built: tray_update alone would
+       leave it for the first hover */
+    QueryPerformanceCounter(&t);
     tray_update(tray);
+    tray_lock();
+    if (ctx->menu_dirty) tray_build_menu(ctx);
+    LeaveCriticalSection(&tray_cs);
+    ctx->timings.menu_ms  = elapsed_ms(t);
+    ctx->timings.total_ms = elapsed_ms(start);
+    trace_end(span, "tray_init", "init", NULL);
     return 0;
 }
 
@@ -514,8 +1976,11 @@ int tray_loop(int blocking)
 
     /* Ensure there is at least one context for this thread */
     DWORD tid = GetCurrentThreadId();
-    EnterCriticalSection(&tray_cs);
+    tray_lock();
     TrayContext *ctx = find_ctx_by_thread(tid);
+    /* Fast start: deferred work runs once the queue is idle */
+    if (ctx && ctx->startup_pending && !PeekMessageW(&msg, NULL, 0, 0, PM_NOREMOVE))
+        tray_finish_startup(ctx);
     LeaveCriticalSection(&tray_cs);
     if (!ctx) return -1;
 
@@ -535,7 +2000,13 @@ int tray_loop(int blocking)
         return -1;
 
     TranslateMessage(&msg);
+    LONGLONG t = trace_begin();
     DispatchMessageW(&msg);
+    if (t) {
+        char id[16];
+        snprintf(id, sizeof(id), "0x%04x", msg.message);
+        trace_end(t, "dispatch", "message", id);
+    }
     return 0;
 }
 
@@ -544,8 +2015,9 @@ void tray_update(struct tray *tray)
 {
     if (!tray) return;
 
+    LONGLONG span = trace_begin();
     ensure_critical_section();
-    EnterCriticalSection(&tray_cs);
+    tray_lock();
 
     /* Prefer thread-local context to tolerate different struct pointers across updates */
     TrayContext *ctx = find_ctx_by_thread(GetCurrentThreadId());
@@ -555,56 +2027,39 @@ void tray_update(struct tray *tray)
     /* Update pointer to reflect latest struct (callbacks, etc.) */
     ctx->tray = tray;
 
-    // Clean up old menu and its bitmaps
-    if (ctx->hmenu) {
-        MENUITEMINFOW item = {0};
-        item.cbSize = sizeof(item);
-        item.fMask = MIIM_BITMAP;
-
-        int count = GetMenuItemCount(ctx->hmenu);
-        for (int i = 0; i < count; i++) {
-            if (GetMenuItemInfoW(ctx->hmenu, i, TRUE, &item)) {
-                if (item.hbmpItem && item.hbmpItem != HBMMENU_CALLBACK) {
-                    DeleteObject(item.hbmpItem);
-                }
-            }
+    /* Icon: the current one stays visible until its replacement is
+       decoded; the same path keeps the icon shown or being decoded */
+    const char *icon = tray->icon_filepath && *tray->icon_filepath ? tray->icon_filepath : NULL;
+    if (!icon || !ctx->icon_path || strcmp(ctx->icon_path->key, icon) != 0) {
+        icon_job_cancel(&ctx->notify_job);
+        wstr_release(ctx->icon_path);
+        ctx->icon_path = wstr_intern(icon);
+        IconJob *job = ctx->icon_path ? icon_job_new(ctx->hwnd, 0) : NULL;
+        if (job) {
+            job->tray_icon_path = ctx->icon_path;
+            InterlockedIncrement(&job->tray_icon_path->refs);
+            icon_job_submit(&ctx->notify_job, job);
+        } else {
+            wstr_release(ctx->icon_path);      /* out of memory: retried next time */
+            ctx->icon_path = NULL;
         }
-        DestroyMenu(ctx->hmenu);
-        ctx->hmenu = NULL;
-    }
-
-    UINT   id = ID_TRAY_FIRST;
-    ctx->hmenu = tray_menu_item(tray->menu, &id);
-
-    /* Icon */
-    HICON icon = NULL;
-    if (tray->icon_filepath && *tray->icon_filepath) {
-        LPWSTR wpath = utf8_to_wide(tray->icon_filepath);
-        if (wpath) {
-            ExtractIconExW(wpath, 0, NULL, &icon, 1);
-            free(wpath);
+        if (!icon && ctx->nid.hIcon) {
+            DestroyIcon(ctx->nid.hIcon);
+            ctx->nid.hIcon = NULL;
         }
     }
-    if (ctx->nid.hIcon && ctx->nid.hIcon != icon) {
-        DestroyIcon(ctx->nid.hIcon);
-    }
-    ctx->nid.hIcon = icon;
 
-    /* Tooltip */
-    ctx->nid.uFlags = NIF_ICON | NIF_MESSAGE;
-    if (tray->tooltip && *tray->tooltip) {
-        LPWSTR wtooltip = utf8_to_wide(tray->tooltip);
-        if (wtooltip) {
-            wcsncpy_s(ctx->nid.szTip, sizeof(ctx->nid.szTip)/sizeof(WCHAR), wtooltip, _TRUNCATE);
-            ctx->nid.uFlags |= NIF_TIP;
-            free(wtooltip);
-        }
-    }
+    tray_set_tooltip(ctx, tray);
 
     /* Update the tray */
-    Shell_NotifyIconW(NIM_MODIFY, &ctx->nid);
+    tray_notify(NIM_MODIFY, &ctx->nid);
+
+    /* Menu: rebuilt lazily when the pointer hovers the icon or on click,
+       so bursts of updates cost one build */
+    ctx->menu_dirty = TRUE;
 
     LeaveCriticalSection(&tray_cs);
+    trace_end(span, "tray_update", "update", tray->tooltip);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -613,7 +2068,7 @@ void tray_update(struct tray *tray)
 void tray_exit(void)
 {
     ensure_critical_section();
-    EnterCriticalSection(&tray_cs);
+    tray_lock();
 
     TrayContext *ctx = find_ctx_by_thread(GetCurrentThreadId());
     if (!ctx) ctx = g_ctx_head; /* fallback */
@@ -623,39 +2078,307 @@ void tray_exit(void)
     }
 
     /* Remove tray icon */
-    Shell_NotifyIconW(NIM_DELETE, &ctx->nid);
+    tray_notify(NIM_DELETE, &ctx->nid);
     if (ctx->nid.hIcon) {
         DestroyIcon(ctx->nid.hIcon);
         ctx->nid.hIcon = NULL;
     }
 
-    /* Post WM_QUIT to unblock any blocking GetMessage call and destroy window */
-    if (ctx->hwnd) {
-        PostMessageW(ctx->hwnd, WM_QUIT, 0, 0);
-        DestroyWindow(ctx->hwnd);
-        ctx->hwnd = NULL;
-    }
+    /* Post WM_QUIT to unblock any blocking GetMessage call */
+    if (ctx->hwnd) PostMessageW(ctx->hwnd, WM_QUIT, 0, 0);
 
-    /* Destroy context (frees menu bitmaps, etc.) */
+    /* Destroy context and window (frees menu bitmaps, queued icons, etc.) */
     destroy_ctx(ctx);
 
-    /* If no more contexts, unregister class and optionally release critical section */
-    if (!g_ctx_head) {
-        UnregisterClassW(WC_TRAY_CLASS_NAME, GetModuleHandleW(NULL));
-        LeaveCriticalSection(&tray_cs);
-        DeleteCriticalSection(&tray_cs);
-        cs_initialized = FALSE;
+    /* If no more contexts, unregister class and release the critical
+       section; with a popup still open, the popup does it on close */
+    if (!g_ctx_head && !g_ctx_pinned) {
+        tray_shutdown_locked();
         return;
     }
 
     LeaveCriticalSection(&tray_cs);
 }
 
+/* -------------------------------------------------------------------------- */
+/*  Targeted item updates: patch the current generation by command ID;       */
+/*  when the popup shows that generation the change is visible right away    */
+/* -------------------------------------------------------------------------- */
+
+/* Builds changes a tray_update left for the next hover, so handles act on
+   the host's current items. Handle calls come from any thread: a fast
+   start's deferred work stays with the UI thread, and until it has run
+   there is no menu to act on. Caller holds tray_cs. */
+static MenuGen *tray_current_menu(TrayContext *ctx)
+{
+    if (ctx->menu_dirty && !ctx->startup_pending) tray_build_menu(ctx);
+    return ctx->menu_dirty ? NULL : ctx->menu;
+}
+
+/* Whether item is part of the menu tree m */
+static BOOL tray_menu_contains(struct tray_menu_item *m, const struct tray_menu_item *item)
+{
+    for (; m && m->text; ++m) {
+        if (m == item) return TRUE;
+        if (m->submenu && tray_menu_contains(m->submenu, item)) return TRUE;
+    }
+    return FALSE;
+}
+
+/* Resolves a handle to its context and item; caller holds tray_cs. Tags
+   are unique across trays, so the tag alone picks the context. */
+static TrayContext* ctx_from_handle(int handle, struct tray_menu_item **out)
+{
+    if (handle <= 0) return NULL;
+    UINT tag   = TRAY_HANDLE_TAG(handle);
+    UINT index = TRAY_HANDLE_CMD(handle) - ID_TRAY_FIRST;
+    for (TrayContext *p = g_ctx_head; p; p = p->next) {
+        if (!p->menu || p->menu->layout != tag) continue;
+        MenuGen *gen = tray_current_menu(p);       /* may retire the tag */
+        if (!gen || gen->layout != tag) return NULL;
+        if (!gen->hmenu || index >= gen->item_count || !gen->items[index].item) return NULL;
+        if (out) *out = gen->items[index].item;
+        return p;
+    }
+    return NULL;
+}
+
+static int tray_item_set_state(int handle, UINT flag, BOOL on)
+{
+    int rc = -1;
+    ensure_critical_section();
+    tray_lock();
+
+    struct tray_menu_item *mi = NULL;
+    TrayContext *ctx = ctx_from_handle(handle, &mi);
+    if (ctx) {
+        UINT cmd = TRAY_HANDLE_CMD(handle);
+        MENUITEMINFOW info = {0};
+        info.cbSize = sizeof(info);
+        info.fMask  = MIIM_STATE;
+        if (GetMenuItemInfoW(ctx->menu->hmenu, cmd, FALSE, &info)) {
+            if (on) info.fState |= flag;
+            else    info.fState &= ~flag;
+            if (SetMenuItemInfoW(ctx->menu->hmenu, cmd, FALSE, &info)) {
+                /* Keep the caller's struct in sync so a later tray_update agrees */
+                if (flag == MFS_CHECKED)  mi->checked  = on ? 1 : 0;
+                if (flag == MFS_DISABLED) mi->disabled = on ? 1 : 0;
+                rc = 0;
+            }
+        }
+    }
+
+    LeaveCriticalSection(&tray_cs);
+    return rc;
+}
+
+int tray_item_get_handle(struct tray_menu_item *item)
+{
+    if (!item) return -1;
+
+    int handle = -1;
+    ensure_critical_section();
+    tray_lock();
+    for (TrayContext *p = g_ctx_head; p && handle < 0; p = p->next) {
+        /* Only a tray whose pending menu holds the item gets built */
+        if (p->menu_dirty && !tray_menu_contains(p->tray ? p->tray->menu : NULL, item))
+            continue;
+        MenuGen *gen = tray_current_menu(p);
+        for (UINT i = 0; gen && i < gen->item_count && i < TRAY_HANDLE_MAX_ITEMS; i++) {
+            if (gen->items[i].item == item) {
+                handle = TRAY_ITEM_HANDLE(gen->layout, ID_TRAY_FIRST + i);
+                break;
+            }
+        }
+    }
+    LeaveCriticalSection(&tray_cs);
+    return handle;
+}
+
+int tray_item_set_checked(int handle, int checked)
+{
+    return tray_item_set_state(handle, MFS_CHECKED, checked != 0);
+}
+
+int tray_item_set_enabled(int handle, int enabled)
+{
+    return tray_item_set_state(handle, MFS_DISABLED, enabled == 0);
+}
+
+int tray_item_set_text(int handle, const char *text)
+{
+    WStr *wtext = wstr_intern(text);
+    if (!wtext) return -1;
+
+    int rc = -1;
+    ensure_critical_section();
+    tray_lock();
+
+    TrayContext *ctx = ctx_from_handle(handle, NULL);
+    if (ctx) {
+        MENUITEMINFOW info = {0};
+        info.cbSize     = sizeof(info);
+        info.fMask      = MIIM_STRING;
+        info.dwTypeData = wtext->wide;
+        info.cch        = wtext->wlen;
+        if (SetMenuItemInfoW(ctx->menu->hmenu, TRAY_HANDLE_CMD(handle), FALSE, &info))
+            rc = 0;
+    }
+
+    LeaveCriticalSection(&tray_cs);
+    wstr_release(wtext);
+    return rc;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Timeline tracing                                                          */
+/* -------------------------------------------------------------------------- */
+int tray_trace_start(const char *path)
+{
+    LPWSTR wpath = utf8_to_wide(path);
+    if (!wpath) return -1;
+    FILE *f = _wfopen(wpath, L"wb");
+    free(wpath);
+    if (!f) return -1;
+    if (trace_start(f, NULL, NULL) < 0) {
+        fclose(f);
+        return -1;
+    }
+    return 0;
+}
+
+int tray_trace_start_sink(tray_trace_sink sink, void *user)
+{
+    if (!sink) return -1;
+    return trace_start(NULL, sink, user);
+}
+
+void tray_trace_stop(void)
+{
+    if (!InterlockedExchange(&g_trace_on, 0)) return;
+    while (InterlockedCompareExchange(&g_trace_busy, 0, 0)) Sleep(0);
+
+    /* No span is being recorded now: write out and free every buffer,
+       including those of threads that have exited. TlsAlloc starts the
+       next session with an empty slot in every thread. */
+    EnterCriticalSection(&trace_cs);
+    while (g_trace_bufs) {
+        TraceBuf *b = g_trace_bufs;
+        trace_flush_buf(b);
+        g_trace_bufs = b->next;
+        free(b);
+    }
+    g_trace_last = &g_trace_bufs;
+    static const char tail[] = "\n],\"displayTimeUnit\":\"ms\"}\n";
+    trace_write(tail, sizeof(tail) - 1);
+    if (g_trace_file) fclose(g_trace_file);
+    g_trace_file = NULL;
+    g_trace_sink = NULL;
+    g_trace_user = NULL;
+    LeaveCriticalSection(&trace_cs);
+
+    DeleteCriticalSection(&trace_cs);
+    TlsFree(g_trace_tls);
+    g_trace_tls = TLS_OUT_OF_INDEXES;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Startup timings, popup latency and string cache statistics                */
+/* -------------------------------------------------------------------------- */
+int tray_get_startup_timings(struct tray_startup_timings *out)
+{
+    if (!out) return -1;
+
+    ensure_critical_section();
+    tray_lock();
+    TrayContext *ctx = find_ctx_by_thread(GetCurrentThreadId());
+    if (!ctx) ctx = g_ctx_head; /* fallback */
+    if (ctx) *out = ctx->timings;
+    LeaveCriticalSection(&tray_cs);
+    return ctx ? 0 : -1;
+}
+
+int tray_get_menu_latency(struct tray_menu_latency *out)
+{
+    if (!out) return -1;
+
+    ensure_critical_section();
+    tray_lock();
+    TrayContext *ctx = find_ctx_by_thread(GetCurrentThreadId());
+    if (!ctx) ctx = g_ctx_head; /* fallback */
+    if (ctx) *out = ctx->latency;
+    LeaveCriticalSection(&tray_cs);
+    return ctx ? 0 : -1;
+}
+
+int tray_get_string_stats(struct tray_string_stats *out)
+{
+    if (!out) return -1;
+    wstr_init();
+    EnterCriticalSection(&wstr_cs);
+    *out = wstr_stats;
+    LeaveCriticalSection(&wstr_cs);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Polled events                                                             */
+/* -------------------------------------------------------------------------- */
+int tray_get_id(struct tray *tray)
+{
+    ensure_critical_section();
+    tray_lock();
+    TrayContext *ctx = find_ctx_by_tray(tray);
+    int id = ctx ? (int)ctx->uID : -1;
+    LeaveCriticalSection(&tray_cs);
+    return id;
+}
+
+void tray_set_event_mode(int polled)
+{
+    if (polled) event_queue_init();
+    InterlockedExchange(&g_event_mode, polled ? 1 : 0);
+}
+
+int tray_poll_events(struct tray_event *buf, int max)
+{
+    if (!buf || max <= 0 || !g_events_ready) return 0;
+
+    int n = 0;
+    LONG pos = event_load(&g_event_tail);
+    while (n < max) {
+        EventCell *cell = &g_events[pos & (TRAY_EVENT_QUEUE_SIZE - 1)];
+        LONG next = (LONG)((ULONG)pos + 1);
+        LONG dif  = event_dist(event_load(&cell->seq), next);
+        if (dif == 0) {
+            LONG seen = InterlockedCompareExchange(&g_event_tail, next, pos);
+            if (seen == pos) {
+                buf[n++] = cell->ev;
+                /* free the cell for the writer one lap ahead */
+                InterlockedExchange(&cell->seq, (LONG)((ULONG)pos + TRAY_EVENT_QUEUE_SIZE));
+                pos = next;
+            } else {
+                pos = seen;
+            }
+        } else if (dif < 0) {
+            break;                                            /* empty */
+        } else {
+            pos = event_load(&g_event_tail);
+        }
+    }
+    return n;
+}
+
+unsigned int tray_get_dropped_events(void)
+{
+    return (unsigned int)event_load(&g_events_dropped);
+}
+
 static BOOL get_tray_icon_rect(RECT *r)
 {
     /* Use per-thread context to identify the correct tray icon */
     ensure_critical_section();
-    EnterCriticalSection(&tray_cs);
+    tray_lock();
     TrayContext *ctx = find_ctx_by_thread(GetCurrentThreadId());
     if (!ctx) ctx = g_ctx_head; /* fallback to first */
     HWND l_hwnd = ctx ? ctx->hwnd : NULL;